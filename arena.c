@@ -0,0 +1,205 @@
+/*  arena.c - the bump arena of the walk and the slab pool of the jobs
+
+    Copyright (C) 1998-2011  "Andy Xuming" <xuming@users.sourceforge.net>
+
+    This file is part of RENAME, a utility to help file renaming
+
+    RENAME is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    RENAME is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#if STDC_HEADERS
+  #include <string.h>
+#endif
+
+#if HAVE_UNISTD_H
+  #include <sys/types.h>
+  #include <unistd.h>
+#endif
+
+#if HAVE_REGEX_H
+  #include <regex.h>
+#else
+  #include "regex.h"
+#endif
+
+#include "rename.h"
+
+/* The arena hands out the memory of a directory by bumping a pointer in
+   big chunks. The walk marks the arena when it enters a directory and
+   releases it to the mark when it leaves, so the names of the directories
+   on the path are stacked up in the arena and nothing is freed one by one.
+   The chunks released are kept for the next directories.
+
+   The pool hands out the objects of one size, carved from the slabs. Only
+   the owner thread takes them but any thread puts them back, onto a list
+   which the owner takes as a whole once its own list runs out. */
+#define ARENA_CHUNK	(64 * 1024)
+#define ARENA_ALIGN	16
+#define POOL_SLAB	(64 * 1024)
+
+struct	_RNMCHUNK	{
+	struct	_RNMCHUNK	*next;
+	size_t	size;		/* of the data */
+	size_t	pad;		/* keep the data aligned */
+};
+
+#define CHUNK_DATA(c)	((char *)((c) + 1))
+
+static RNMCHUNK *arena_chunk(RNMARENA *ar, size_t len);
+
+
+void *rename_arena_alloc(RNMARENA *ar, size_t len)
+{
+	RNMCHUNK	*c;
+	char	*p;
+
+	len = (len + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+	if ((size_t)(ar->end - ar->ptr) < len) {
+		if ((c = arena_chunk(ar, len)) == NULL) {
+			return NULL;
+		}
+		c->next   = ar->chunk;
+		ar->chunk = c;
+		ar->ptr   = CHUNK_DATA(c);
+		ar->end   = ar->ptr + c->size;
+	}
+	p = ar->ptr;
+	ar->ptr += len;
+	return p;
+}
+
+void rename_arena_mark(RNMARENA *ar, RNMMARK *mark)
+{
+	mark->chunk = ar->chunk;
+	mark->ptr   = ar->ptr;
+}
+
+/* drop everything allocated since the mark */
+void rename_arena_release(RNMARENA *ar, RNMMARK *mark)
+{
+	RNMCHUNK	*c;
+
+	while (ar->chunk != mark->chunk) {
+		c = ar->chunk;
+		ar->chunk = c->next;
+		c->next   = ar->spare;
+		ar->spare = c;
+	}
+	ar->ptr = mark->ptr;
+	ar->end = ar->chunk ? CHUNK_DATA(ar->chunk) + ar->chunk->size : NULL;
+}
+
+void rename_arena_free(RNMARENA *ar)
+{
+	RNMCHUNK	*c;
+
+	while ((c = ar->chunk) != NULL) {
+		ar->chunk = c->next;
+		free(c);
+	}
+	while ((c = ar->spare) != NULL) {
+		ar->spare = c->next;
+		free(c);
+	}
+	memset(ar, 0, sizeof(RNMARENA));
+}
+
+/* a spare chunk, or a new one if it's too small for 'len' */
+static RNMCHUNK *arena_chunk(RNMARENA *ar, size_t len)
+{
+	RNMCHUNK	*c;
+
+	if ((c = ar->spare) != NULL) {
+		ar->spare = c->next;
+		if (c->size >= len) {
+			return c;
+		}
+		free(c);
+	}
+	if (len < ARENA_CHUNK) {
+		len = ARENA_CHUNK;
+	}
+	if ((c = malloc(sizeof(RNMCHUNK) + len)) != NULL) {
+		c->size = len;
+	}
+	return c;
+}
+
+
+void rename_pool_init(RNMPOOL *pool, size_t size)
+{
+	memset(pool, 0, sizeof(RNMPOOL));
+	pool->size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+/* an object of the pool; only the owner thread could take them */
+void *rename_pool_get(RNMPOOL *pool)
+{
+	RNMCHUNK	*slab;
+	char	*p;
+	void	*obj;
+	size_t	i, n;
+
+	if (pool->local == NULL) {
+		pool->local = __sync_lock_test_and_set(&pool->shared, NULL);
+	}
+	if (pool->local == NULL) {
+		if ((n = POOL_SLAB / pool->size) == 0) {
+			n = 1;
+		}
+		if ((slab = malloc(sizeof(RNMCHUNK) + n * pool->size)) == NULL) {
+			return NULL;
+		}
+		slab->size  = n * pool->size;
+		slab->next  = pool->slabs;
+		pool->slabs = slab;
+		for (i = 0, p = CHUNK_DATA(slab); i < n; i++, p += pool->size) {
+			*(void **) p = pool->local;
+			pool->local  = p;
+		}
+	}
+	obj = pool->local;
+	pool->local = *(void **) obj;
+	return obj;
+}
+
+/* give the object back, by any thread */
+void rename_pool_put(RNMPOOL *pool, void *obj)
+{
+	void	*head;
+
+	do {
+		head = pool->shared;
+		*(void **) obj = head;
+	} while (!__sync_bool_compare_and_swap(&pool->shared, head, obj));
+}
+
+/* all objects must have been put back */
+void rename_pool_free(RNMPOOL *pool)
+{
+	RNMCHUNK	*slab;
+
+	while ((slab = pool->slabs) != NULL) {
+		pool->slabs = slab->next;
+		free(slab);
+	}
+	pool->local = pool->shared = NULL;
+}
@@ -0,0 +1,350 @@
+/*  matchbench.c - time the name matchers in memory
+
+    Copyright (C) 1998-2011  "Andy Xuming" <xuming@users.sourceforge.net>
+
+    This file is part of RENAME, a utility to help file renaming
+
+    RENAME is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    RENAME is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#if HAVE_REGEX_H
+  #include <regex.h>
+#else
+  #include "regex.h"
+#endif
+
+#include "rename.h"
+
+/* Every matcher is replayed over a corpus of basenames, either generated
+   like bench/mktree does or read from a list of files such as the output
+   of find(1). A name is copied into the buffer before every call since the
+   matchers work in place; the "copy" line is that cost alone, which should
+   be taken off the others when comparing them. No file system is touched,
+   so the numbers only move when the engine does. */
+#define MB_TOKEN	"match"
+#define MB_BUFSIZE	4096	/* the name buffer of the matchers */
+
+typedef	int	(*MATCHER)(const RNMRULE *rule, char *fname, int flen,
+		int *room);
+
+typedef	struct	{
+	char	*name;
+	char	*pattern;	/* the -s argument, NULL if none */
+	MATCHER	func;
+} MBCASE;
+
+static int mb_copy(const RNMRULE *rule, char *fname, int flen, int *room);
+static int mb_inject(const RNMRULE *rule, char *fname, int flen, int *room);
+static int mb_lowercase(const RNMRULE *rule, char *fname, int flen,
+		int *room);
+static int mb_uppercase(const RNMRULE *rule, char *fname, int flen,
+		int *room);
+
+static	MBCASE	cases[] = {
+	{ "copy",      NULL,                 mb_copy },
+	{ "forward",   "/match/hit/g",       match_forward },
+	{ "backward",  "/match/hit/gb",      match_backward },
+	{ "regex",     "/ma[a-z]ch/hit/ge",  match_regexpr },
+	{ "suffix",    "/.c/.cpp/s",         match_suffix },
+	{ "inject",    NULL,                 mb_inject },
+	{ "lowercase", NULL,                 mb_lowercase },
+	{ "uppercase", NULL,                 mb_uppercase },
+	{ NULL, NULL, NULL }
+};
+
+static	char	*usage = "\
+Usage: matchbench [OPTIONS] [MATCHER ...]\n\
+OPTIONS:\n\
+  -f FILE         read the names from FILE, one per line\n\
+  -n NAMES        generate NAMES names (100000)\n\
+  -m PERCENT      generated names containing \"" MB_TOKEN "\" (20)\n\
+  -r ROUNDS       replay the names ROUNDS times (10)\n\
+  -s/PATTERN/STRING[/SW]\n\
+                  time this pattern by its matcher too\n\
+MATCHER is copy, forward, backward, regex, suffix, inject, lowercase or\n\
+uppercase; all of them by default.\n";
+
+static	char	**names;
+static	int	*lens;
+static	int	count;
+static	unsigned long long	seed = 1;
+
+static int mb_load(char *path);
+static int mb_generate(int n, int percent);
+static int mb_run(MBCASE *mc, int rounds);
+static unsigned long long mb_random(void);
+
+
+int main(int argc, char **argv)
+{
+	MBCASE	user = { "pattern", NULL, NULL };
+	char	*list = NULL;
+	int	c, i, n = 100000, percent = 20, rounds = 10;
+
+	while ((c = getopt(argc, argv, "f:n:m:r:s:h")) != -1) {
+		switch (c) {
+		case 'f':
+			list = optarg;
+			break;
+		case 'n':
+			n = atoi(optarg);
+			break;
+		case 'm':
+			percent = atoi(optarg);
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		case 's':
+			user.pattern = optarg;
+			break;
+		default:
+			fputs(usage, stderr);
+			return 1;
+		}
+	}
+	if ((n < 1) || (rounds < 1)) {
+		fputs(usage, stderr);
+		return 1;
+	}
+
+	rename_case_init();
+	if (list ? mb_load(list) : mb_generate(n, percent)) {
+		perror(list ? list : "matchbench");
+		return 2;
+	}
+	if (count == 0) {
+		fprintf(stderr, "matchbench: no names\n");
+		return 2;
+	}
+
+	printf("%d names, %d rounds\n", count, rounds);
+	printf("%-10s %10s %10s %10s\n", "Matcher", "ns/name", "MB/s",
+			"Changed");
+	for (i = 0; cases[i].name; i++) {
+		if (optind < argc) {
+			for (c = optind; c < argc; c++) {
+				if (!strcmp(argv[c], cases[i].name)) {
+					break;
+				}
+			}
+			if ((c == argc) && (i != 0)) {
+				continue;	/* the copy is always shown */
+			}
+		}
+		if (mb_run(&cases[i], rounds) < 0) {
+			return 3;
+		}
+	}
+	if (user.pattern && (mb_run(&user, rounds) < 0)) {
+		return 3;
+	}
+	return 0;
+}
+
+static int mb_run(MBCASE *mc, int rounds)
+{
+	RNMRULE	rule;
+	struct	timespec	t0, t1;
+	char	buffer[MB_BUFSIZE];
+	unsigned long	changed = 0, bytes = 0;
+	double	ns;
+	char	*arg = NULL;
+	int	r, i, rc, room;
+
+	memset(&rule, 0, sizeof(RNMRULE));
+	rule.compare = strncmp;
+	if (mc->pattern) {
+		if ((arg = strdup(mc->pattern)) == NULL) {
+			return -1;
+		}
+		if (rename_pattern(&rule, arg) != RNM_ERR_NONE) {
+			fprintf(stderr, "matchbench: wrong pattern %s\n",
+					mc->pattern);
+			free(arg);
+			return -1;
+		}
+	}
+	if (mc->func == NULL) {
+		switch (rule.action) {
+		case RNM_ACT_BACKWARD:
+			mc->func = match_backward;
+			break;
+		case RNM_ACT_REGEX:
+			mc->func = match_regexpr;
+			break;
+		case RNM_ACT_SUFFIX:
+			mc->func = match_suffix;
+			break;
+		default:
+			mc->func = match_forward;
+			break;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < count; i++) {
+			memcpy(buffer, names[i], lens[i] + 1);
+			room = MB_BUFSIZE - lens[i] - 1;
+			rc = mc->func(&rule, buffer, lens[i], &room);
+			if (rc < 0) {
+				fprintf(stderr, "matchbench: %s overflowed\n",
+						names[i]);
+				return -1;
+			}
+			changed += rc > 0;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	for (i = 0; i < count; i++) {
+		bytes += lens[i];
+	}
+
+	ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+	printf("%-10s %10.1f %10.1f %10lu\n", mc->name,
+			ns / rounds / count,
+			(ns > 0) ? bytes * rounds / ns * 1e3 : 0,
+			changed / rounds);
+
+	if (rule.action == RNM_ACT_REGEX) {
+		regfree(rule.preg);
+	}
+	free(arg);
+	return 0;
+}
+
+static int mb_copy(const RNMRULE *rule, char *fname, int flen, int *room)
+{
+	return fname[0] == 0;
+}
+
+/* a prefix inserted, which moves the whole name */
+static int mb_inject(const RNMRULE *rule, char *fname, int flen, int *room)
+{
+	*room = inject(fname, flen, 0, *room, "pre_", 4);
+	return (*room < 0) ? *room : 1;
+}
+
+static int mb_lowercase(const RNMRULE *rule, char *fname, int flen,
+		int *room)
+{
+	return rename_lowercase(fname, flen, room);
+}
+
+static int mb_uppercase(const RNMRULE *rule, char *fname, int flen,
+		int *room)
+{
+	return rename_uppercase(fname, flen, room);
+}
+
+/* the basenames of the list; the names too long are left out */
+static int mb_load(char *path)
+{
+	FILE	*fp;
+	char	*line = NULL, *p;
+	size_t	size = 0;
+	ssize_t	len;
+	int	room = 0;
+
+	if ((fp = fopen(path, "r")) == NULL) {
+		return -1;
+	}
+	while ((len = getline(&line, &size, fp)) > 0) {
+		if (line[len - 1] == '\n') {
+			line[--len] = 0;
+		}
+		if ((p = strrchr(line, '/')) != NULL) {
+			len -= ++p - line;
+		} else {
+			p = line;
+		}
+		if ((len == 0) || (len > MB_BUFSIZE / 2)) {
+			continue;
+		}
+		if (count == room) {
+			room = room ? room * 2 : 1024;
+			names = realloc(names, room * sizeof(char *));
+			lens  = realloc(lens, room * sizeof(int));
+			if (!names || !lens) {
+				fclose(fp);
+				return -1;
+			}
+		}
+		if ((names[count] = strdup(p)) == NULL) {
+			fclose(fp);
+			return -1;
+		}
+		lens[count++] = len;
+	}
+	free(line);
+	fclose(fp);
+	return 0;
+}
+
+/* mixed case names of 8 to 40 bytes with a suffix, like bench/mktree */
+static int mb_generate(int n, int percent)
+{
+	static	char	alnum[] = "abcdefghijklmnopqrstuvwxyz"
+				  "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_";
+	static	char	*suffix[] = { ".txt", ".c", ".h", ".dat", ".JPG" };
+	char	buf[64], *sfx;
+	int	i, k, len;
+
+	names = malloc(n * sizeof(char *));
+	lens  = malloc(n * sizeof(int));
+	if (!names || !lens) {
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		sfx = suffix[mb_random() % (sizeof(suffix) / sizeof(char *))];
+		len = 8 + mb_random() % 33 - strlen(sfx);
+		for (k = 0; k < len; k++) {
+			buf[k] = alnum[mb_random() % (sizeof(alnum) - 1)];
+		}
+		if (((int)(mb_random() % 100) < percent) &&
+				(len >= (int) strlen(MB_TOKEN))) {
+			k = mb_random() % (len - strlen(MB_TOKEN) + 1);
+			memcpy(buf + k, MB_TOKEN, strlen(MB_TOKEN));
+		}
+		strcpy(buf + len, sfx);
+		if ((names[i] = strdup(buf)) == NULL) {
+			return -1;
+		}
+		lens[i] = strlen(buf);
+	}
+	count = n;
+	return 0;
+}
+
+/* xorshift64* */
+static unsigned long long mb_random(void)
+{
+	seed ^= seed >> 12;
+	seed ^= seed << 25;
+	seed ^= seed >> 27;
+	return seed * 2685821657736338717ULL;
+}
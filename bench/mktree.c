@@ -0,0 +1,251 @@
+/*  mktree.c - generate a reproducible tree of files for the benchmarks
+
+    Copyright (C) 1998-2011  "Andy Xuming" <xuming@users.sourceforge.net>
+
+    This file is part of RENAME, a utility to help file renaming
+
+    RENAME is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    RENAME is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/* The tree is a function of the options and the seed only: the names come
+   from a private xorshift generator rather than rand(3), so the same
+   command line makes the same tree on any libc. Every directory of the
+   'depth' levels has 'fanout' subdirectories and 'files' empty files.
+
+   A file name is made of random letters and digits of mixed case with a
+   suffix, and its length is drawn from a triangular distribution between
+   the shortest and the longest length peaking at 'peak'. 'match' percent of
+   the names carry the token "match" somewhere for the -s scenarios, and
+   'dups' percent reuse a name already made in another directory, which is
+   what the name cache of renamex is for. */
+#define MKT_TOKEN	"match"
+#define MKT_NAMEMAX	240
+#define MKT_POOL	4096
+
+static	char	*suffix[] = { ".txt", ".c", ".h", ".dat", ".JPG", ".tar.gz" };
+
+static	struct	{
+	int	depth;
+	int	fanout;
+	int	files;
+	int	minlen, peak, maxlen;
+	int	match;
+	int	dups;
+	unsigned long long	seed;
+
+	char	*pool[MKT_POOL];
+	int	pooled;
+	unsigned long	dirs, made;
+} mkt = { 3, 8, 100, 8, 16, 40, 20, 10, 1 };
+
+static	char	*usage = "\
+Usage: mktree [OPTIONS] DIRECTORY\n\
+OPTIONS:\n\
+  -d DEPTH        levels of subdirectories (3)\n\
+  -f FANOUT       subdirectories in every directory (8)\n\
+  -n FILES        files in every directory (100)\n\
+  -l MIN:PEAK:MAX lengths of the file names (8:16:40)\n\
+  -m PERCENT      names containing \"" MKT_TOKEN "\" (20)\n\
+  -u PERCENT      names duplicated from other directories (10)\n\
+  -s SEED         seed of the random names (1)\n";
+
+static unsigned long long mkt_random(void);
+static int mkt_percent(int percent);
+static int mkt_length(void);
+static char *mkt_name(char *buf);
+static int mkt_dir(int dfd, int level);
+
+
+int main(int argc, char **argv)
+{
+	int	c, dfd;
+
+	while ((c = getopt(argc, argv, "d:f:n:l:m:u:s:h")) != -1) {
+		switch (c) {
+		case 'd':
+			mkt.depth = atoi(optarg);
+			break;
+		case 'f':
+			mkt.fanout = atoi(optarg);
+			break;
+		case 'n':
+			mkt.files = atoi(optarg);
+			break;
+		case 'l':
+			if (sscanf(optarg, "%d:%d:%d", &mkt.minlen, &mkt.peak,
+					&mkt.maxlen) != 3) {
+				fputs(usage, stderr);
+				return 1;
+			}
+			break;
+		case 'm':
+			mkt.match = atoi(optarg);
+			break;
+		case 'u':
+			mkt.dups = atoi(optarg);
+			break;
+		case 's':
+			mkt.seed = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			fputs(usage, stderr);
+			return 1;
+		}
+	}
+	if ((optind + 1 != argc) || (mkt.depth < 0) || (mkt.fanout < 0) ||
+			(mkt.files < 0) || (mkt.minlen < 1) ||
+			(mkt.peak < mkt.minlen) || (mkt.maxlen < mkt.peak) ||
+			(mkt.maxlen > MKT_NAMEMAX)) {
+		fputs(usage, stderr);
+		return 1;
+	}
+	if (mkt.seed == 0) {
+		mkt.seed = 1;	/* xorshift is stuck at zero */
+	}
+
+	if ((mkdir(argv[optind], 0755) < 0) && (errno != EEXIST)) {
+		perror(argv[optind]);
+		return 2;
+	}
+	if ((dfd = open(argv[optind], O_RDONLY | O_DIRECTORY)) < 0) {
+		perror(argv[optind]);
+		return 2;
+	}
+	if (mkt_dir(dfd, 0) < 0) {
+		perror(argv[optind]);
+		return 2;
+	}
+	close(dfd);
+	printf("%lu directories, %lu files\n", mkt.dirs, mkt.made);
+	return 0;
+}
+
+static int mkt_dir(int dfd, int level)
+{
+	char	name[MKT_NAMEMAX + 16];
+	int	i, k, fd;
+
+	mkt.dirs++;
+	for (i = 0; i < mkt.files; i++) {
+		if (mkt.pooled && mkt_percent(mkt.dups)) {
+			strcpy(name, mkt.pool[mkt_random() % mkt.pooled]);
+		} else {
+			mkt_name(name);
+		}
+		/* a name may come twice into a directory, either duplicated
+		 * or by chance, then a new one is made */
+		while ((fd = openat(dfd, name, O_WRONLY | O_CREAT | O_EXCL,
+						0644)) < 0) {
+			if (errno != EEXIST) {
+				return -1;
+			}
+			mkt_name(name);
+		}
+		close(fd);
+		mkt.made++;
+
+		/* the pool is kept a sample of the whole tree */
+		if (mkt.pooled < MKT_POOL) {
+			mkt.pool[mkt.pooled++] = strdup(name);
+		} else {
+			k = mkt_random() % MKT_POOL;
+			free(mkt.pool[k]);
+			mkt.pool[k] = strdup(name);
+		}
+	}
+	if (level >= mkt.depth) {
+		return 0;
+	}
+	for (i = 0; i < mkt.fanout; i++) {
+		sprintf(name, "d%03d", i);
+		if ((mkdirat(dfd, name, 0755) < 0) && (errno != EEXIST)) {
+			return -1;
+		}
+		if ((fd = openat(dfd, name, O_RDONLY | O_DIRECTORY)) < 0) {
+			return -1;
+		}
+		if (mkt_dir(fd, level + 1) < 0) {
+			close(fd);
+			return -1;
+		}
+		close(fd);
+	}
+	return 0;
+}
+
+static char *mkt_name(char *buf)
+{
+	static	char	alnum[] = "abcdefghijklmnopqrstuvwxyz"
+				  "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_";
+	char	*sfx;
+	int	i, len, base;
+
+	sfx  = suffix[mkt_random() % (sizeof(suffix) / sizeof(char *))];
+	len  = mkt_length();
+	base = len - (int) strlen(sfx);
+	if (base < 1) {
+		base = 1;
+	}
+	for (i = 0; i < base; i++) {
+		buf[i] = alnum[mkt_random() % (sizeof(alnum) - 1)];
+	}
+	if (mkt_percent(mkt.match) && (base >= (int) strlen(MKT_TOKEN))) {
+		i = mkt_random() % (base - strlen(MKT_TOKEN) + 1);
+		memcpy(buf + i, MKT_TOKEN, strlen(MKT_TOKEN));
+	}
+	strcpy(buf + base, sfx);
+	return buf;
+}
+
+/* the triangular distribution by the inverse of its CDF */
+static int mkt_length(void)
+{
+	double	u, a, b, c;
+
+	a = mkt.minlen;
+	b = mkt.maxlen + 1;
+	c = mkt.peak;
+	if (a + 1 >= b) {
+		return mkt.minlen;
+	}
+	u = (mkt_random() >> 11) / 9007199254740992.0;
+	if (u < (c - a) / (b - a)) {
+		return (int)(a + sqrt(u * (b - a) * (c - a)));
+	}
+	return (int)(b - sqrt((1 - u) * (b - a) * (b - c)));
+}
+
+static int mkt_percent(int percent)
+{
+	return (int)(mkt_random() % 100) < percent;
+}
+
+/* xorshift64* */
+static unsigned long long mkt_random(void)
+{
+	mkt.seed ^= mkt.seed >> 12;
+	mkt.seed ^= mkt.seed << 25;
+	mkt.seed ^= mkt.seed >> 27;
+	return mkt.seed * 2685821657736338717ULL;
+}
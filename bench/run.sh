@@ -0,0 +1,80 @@
+#!/bin/sh
+#
+#  run.sh - run the standard scenarios of renamex over the synthetic trees
+#
+#  usage: run.sh [RENAMEX [MKTREE]]
+#
+#  The environment may set:
+#    BENCH_DIR    where the trees are made, preferably a tmpfs (/dev/shm)
+#    TREEFLAGS    the options of mktree, like "-d 4 -f 6 -n 200 -m 50"
+#    RENAMEFLAGS  extra options of renamex for every scenario, like "-j 4"
+#
+#  Every scenario runs on a fresh tree of the same seed. The files per
+#  second and the system calls per file are worked out from the --stats of
+#  renamex; the system calls are counted by strace(1) if it is installed,
+#  otherwise they are estimated from the directories read (open, getdents,
+#  close), the stat calls and the files changed.
+
+RENAMEX=`cd \`dirname ${1:-./renamex}\` && pwd`/`basename ${1:-renamex}`
+MKTREE=${2:-bench/mktree}
+BENCH_DIR=${BENCH_DIR:-/dev/shm}
+TREE=$BENCH_DIR/renamex-bench.$$
+STATS=$TREE.stats
+
+trap 'rm -rf $TREE $STATS $STATS.trace' 0 1 2 15
+
+# the number after the label in the --stats report
+stat_of()
+{
+	sed -n "s/^$1: *\([0-9.]*\).*/\1/p" $STATS
+}
+
+scenario()
+{
+	name=$1
+	shift
+	rm -rf $TREE
+	$MKTREE $TREEFLAGS $TREE > /dev/null || exit 1
+	(cd $TREE && $RENAMEX --stats $RENAMEFLAGS "$@" -R .) \
+		< /dev/null > $STATS 2>&1 || { cat $STATS; exit 1; }
+
+	entries=`stat_of "Entries seen"`
+	dirs=`stat_of "Directories read"`
+	stats=`stat_of "Stat calls"`
+	renamed=`stat_of "Renamed"`
+	owned=`stat_of "Ownership changed"`
+	moded=`stat_of "Permission changed"`
+	changed=`expr $renamed + $owned + $moded`
+	wall=`sed -n 's/^Total: *\([0-9.]*\)s wall.*/\1/p' $STATS`
+
+	if [ -n "$STRACE" ]; then
+		rm -rf $TREE
+		$MKTREE $TREEFLAGS $TREE > /dev/null || exit 1
+		(cd $TREE && $STRACE -f -c -o $STATS.trace \
+			$RENAMEX $RENAMEFLAGS "$@" -R .) < /dev/null > /dev/null 2>&1
+		calls=`awk '$NF == "total" { print $(NF-2) }' $STATS.trace`
+		how=strace
+	else
+		calls=`expr $dirs \* 3 + $stats + $changed`
+		how=estimated
+	fi
+
+	awk -v n="$name" -v e=$entries -v w=$wall -v r=$changed -v c=$calls \
+		-v h=$how 'BEGIN {
+		printf "%-10s %9d %9d %8.3f %12.0f %8.2f %s\n", n, e, r, w,
+			(w > 0) ? e / w : 0, (e > 0) ? c / e : 0, h }'
+}
+
+STRACE=`command -v strace`
+
+echo "Tree in $BENCH_DIR: `$MKTREE $TREEFLAGS $TREE`"
+printf "%-10s %9s %9s %8s %12s %8s\n" \
+	Scenario Files Changed Seconds Files/s Calls/f
+scenario lowercase -N -l
+scenario literal -N -s/match/hit/g
+scenario regex -N '-s/ma[a-z]ch/hit/e'
+if [ `id -u` -eq 0 ]; then
+	scenario chown -o daemon:daemon
+else
+	echo "chown      skipped, it needs the superuser"
+fi
@@ -0,0 +1,165 @@
+/*  cache.c - memoize the name transforms of repeated basenames
+
+    Copyright (C) 1998-2011  "Andy Xuming" <xuming@users.sourceforge.net>
+
+    This file is part of RENAME, a utility to help file renaming
+
+    RENAME is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    RENAME is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#if HAVE_UNISTD_H
+  #include <sys/types.h>
+#endif
+
+#if STDC_HEADERS
+  #include <string.h>
+#endif
+
+#if HAVE_REGEX_H
+  #include <regex.h>
+#else
+  #include "regex.h"
+#endif
+
+#include "rename.h"
+
+/* The cache is a direct mapped table. Each slot owns a single memory block
+   which keeps the basename and its transformed name back to back, so a
+   collision simply throws the older entry away. The size of the table is
+   the only bound of the memory it could take. */
+typedef	struct	{
+	unsigned	hash;
+	int		state;		/* RNM_CACHE_NOMATCH/SAME/NEW */
+	int		klen;
+	char		*key;		/* key and value in one block */
+	char		*value;
+} RNMCENT;
+
+struct	_RNMCACHE	{
+	RNMCENT		*slot;
+	unsigned	mask;
+};
+
+
+/* FNV-1a, it's quick enough for short strings like file names */
+unsigned rename_hash(const char *s, int len)
+{
+	unsigned	h = 2166136261U;
+
+	while (len-- > 0) {
+		h ^= (unsigned char) *s++;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+int rename_cache_open(RENOP *opt, int slots)
+{
+	struct	_RNMCACHE	*cache;
+	unsigned	n;
+
+	if (slots <= 0) {
+		return RNM_ERR_NONE;	/* cache disabled */
+	}
+	for (n = 1; n < slots; n <<= 1);	/* round to power of 2 */
+
+	if ((cache = malloc(sizeof(struct _RNMCACHE))) == NULL) {
+		return RNM_ERR_LOWMEM;
+	}
+	if ((cache->slot = calloc(n, sizeof(RNMCENT))) == NULL) {
+		free(cache);
+		return RNM_ERR_LOWMEM;
+	}
+	cache->mask = n - 1;
+	opt->cache = cache;
+	return RNM_ERR_NONE;
+}
+
+void rename_cache_close(RENOP *opt)
+{
+	unsigned	i;
+
+	if (opt->cache == NULL) {
+		return;
+	}
+	for (i = 0; i <= opt->cache->mask; i++) {
+		free(opt->cache->slot[i].key);
+	}
+	free(opt->cache->slot);
+	free(opt->cache);
+	opt->cache = NULL;
+}
+
+/* lookup the transformed name of the basename 'name'. It returns the
+   RNM_CACHE_MISS if the basename was not seen yet. If it returns
+   RNM_CACHE_NEW, the 'newname' points to the transformed name. */
+int rename_cache_lookup(RENOP *opt, const char *name, int nlen,
+		const char **newname)
+{
+	RNMCENT		*ent;
+	unsigned	hash;
+
+	hash = rename_hash(name, nlen);
+	ent = &opt->cache->slot[hash & opt->cache->mask];
+	if ((ent->key == NULL) || (ent->hash != hash) || (ent->klen != nlen)
+			|| memcmp(ent->key, name, nlen)) {
+		opt->stats.c_miss++;
+		return RNM_CACHE_MISS;
+	}
+	opt->stats.c_hit++;
+	if (newname) {
+		*newname = ent->value;
+	}
+	return ent->state;
+}
+
+/* store the transform result of the basename 'name'. The 'newname' is only
+   needed by the RNM_CACHE_NEW state. Failing to store is not an error; the
+   name will be transformed again next time. */
+void rename_cache_store(RENOP *opt, const char *name, int nlen,
+		const char *newname, int state)
+{
+	RNMCENT		*ent;
+	unsigned	hash;
+	int		vlen;
+	char		*p;
+
+	vlen = (state == RNM_CACHE_NEW) ? strlen(newname) : 0;
+	if ((p = malloc(nlen + vlen + 2)) == NULL) {
+		return;
+	}
+	memcpy(p, name, nlen);
+	p[nlen] = 0;
+	if (vlen) {
+		memcpy(p + nlen + 1, newname, vlen);
+	}
+	p[nlen + 1 + vlen] = 0;
+
+	hash = rename_hash(name, nlen);
+	ent = &opt->cache->slot[hash & opt->cache->mask];
+	free(ent->key);		/* evict the previous owner of the slot */
+	ent->hash  = hash;
+	ent->state = state;
+	ent->klen  = nlen;
+	ent->key   = p;
+	ent->value = p + nlen + 1;
+}
@@ -0,0 +1,255 @@
+/*  casemap.c - lowercase and uppercase the file names
+
+    Copyright (C) 1998-2011  "Andy Xuming" <xuming@users.sourceforge.net>
+
+    This file is part of RENAME, a utility to help file renaming
+
+    RENAME is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    RENAME is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <ctype.h>
+#include <pthread.h>
+#include <stdio.h>
+
+#if STDC_HEADERS
+  #include <string.h>
+#endif
+
+#if HAVE_UNISTD_H
+  #include <sys/types.h>
+#endif
+
+#if HAVE_REGEX_H
+  #include <regex.h>
+#else
+  #include "regex.h"
+#endif
+
+#ifdef	__SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "rename.h"
+
+/* The names are taken as UTF-8. ASCII is done 16 bytes a time where SSE2 is
+   available, other characters are looked up in the range tables generated
+   by mkcasetab.py. Bytes which are not valid UTF-8 are converted by tables
+   filled by the tolower()/toupper() of the current locale, so there is no
+   function call per byte. The encoded length of a few characters changes
+   with the case, so the conversion may need some room after the string.
+*/
+typedef	struct	{
+	unsigned	first;
+	unsigned short	count;
+	unsigned char	stride;
+	int		delta;
+} RNMCASE;
+
+#include "casetab.h"
+
+#define CASE_MAP_SIZE(m)	((int)(sizeof(m) / sizeof(RNMCASE)))
+
+static	unsigned char	case_table[2][256];	/* lower, upper */
+
+
+void rename_case_init(void)
+{
+	int	i;
+
+	for (i = 0; i < 256; i++) {
+		case_table[0][i] = (unsigned char) tolower(i);
+		case_table[1][i] = (unsigned char) toupper(i);
+	}
+}
+
+static unsigned case_lookup(int upper, unsigned cp)
+{
+	const RNMCASE	*map;
+	int	lo, hi, mid;
+
+	if (upper) {
+		map = case_upper_map;
+		hi  = CASE_MAP_SIZE(case_upper_map) - 1;
+	} else {
+		map = case_lower_map;
+		hi  = CASE_MAP_SIZE(case_lower_map) - 1;
+	}
+	/* find the last range starting at or before the code point */
+	for (lo = 0; lo < hi; ) {
+		mid = (lo + hi + 1) / 2;
+		if (map[mid].first <= cp) {
+			lo = mid;
+		} else {
+			hi = mid - 1;
+		}
+	}
+	map += lo;
+	if ((cp < map->first) || 
+			(cp >= map->first + map->count * map->stride) ||
+			((cp - map->first) % map->stride)) {
+		return cp;
+	}
+	return cp + map->delta;
+}
+
+/* decode one UTF-8 character. It returns the length of the sequence or 0
+   if it's not a valid one, for example the overlong forms */
+static int utf8_decode(const unsigned char *s, int len, unsigned *cp)
+{
+	int	n, i;
+
+	if (*s < 0xC2) {
+		return 0;
+	} else if (*s < 0xE0) {
+		n = 2;
+		*cp = *s & 0x1F;
+	} else if (*s < 0xF0) {
+		n = 3;
+		*cp = *s & 0x0F;
+	} else if (*s < 0xF5) {
+		n = 4;
+		*cp = *s & 0x07;
+	} else {
+		return 0;
+	}
+	if (len < n) {
+		return 0;
+	}
+	for (i = 1; i < n; i++) {
+		if ((s[i] & 0xC0) != 0x80) {
+			return 0;
+		}
+		*cp = (*cp << 6) | (s[i] & 0x3F);
+	}
+	if (((n == 3) && ((*cp < 0x800) || ((*cp >= 0xD800) && 
+			(*cp <= 0xDFFF)))) ||
+			((n == 4) && ((*cp < 0x10000) || (*cp > 0x10FFFF)))) {
+		return 0;
+	}
+	return n;
+}
+
+static int utf8_encode(unsigned cp, unsigned char *s)
+{
+	if (cp < 0x80) {
+		s[0] = cp;
+		return 1;
+	} else if (cp < 0x800) {
+		s[0] = 0xC0 | (cp >> 6);
+		s[1] = 0x80 | (cp & 0x3F);
+		return 2;
+	} else if (cp < 0x10000) {
+		s[0] = 0xE0 | (cp >> 12);
+		s[1] = 0x80 | ((cp >> 6) & 0x3F);
+		s[2] = 0x80 | (cp & 0x3F);
+		return 3;
+	}
+	s[0] = 0xF0 | (cp >> 18);
+	s[1] = 0x80 | ((cp >> 12) & 0x3F);
+	s[2] = 0x80 | ((cp >> 6) & 0x3F);
+	s[3] = 0x80 | (cp & 0x3F);
+	return 4;
+}
+
+/* convert the case of 's' in place if 'room' was given, otherwise just
+   check it. The 'room' is the free space after the string, which would be
+   consumed if the converted string became longer.
+   It returns the number of characters which are (or would be) changed, or
+   -1 if the room was not enough.
+*/
+static int case_mapping(unsigned char *s, int len, int upper, int *room)
+{
+	unsigned char	*table = case_table[upper ? 1 : 0], enc[4];
+	unsigned	cp, to;
+	int	changed = 0, n, m;
+#ifdef	__SSE2__
+	__m128i	v, mask, from, range, bit;
+
+	/* shift the letters to the bottom of the signed range so one signed
+	 * comparison finds all 'A'-'Z' (or 'a'-'z') in the vector */
+	from  = _mm_set1_epi8((char)(0x80 - (upper ? 'a' : 'A')));
+	range = _mm_set1_epi8((char)(0x80 + 26));
+	bit   = _mm_set1_epi8(0x20);
+#endif
+
+	while (len > 0) {
+#ifdef	__SSE2__
+		if (len >= 16) {
+			v = _mm_loadu_si128((__m128i *) s);
+			if (_mm_movemask_epi8(v) == 0) {	/* all ASCII */
+				mask = _mm_cmplt_epi8(_mm_add_epi8(v, from), 
+						range);
+				if ((n = _mm_movemask_epi8(mask)) != 0) {
+					changed += __builtin_popcount(n);
+				}
+				if (n && room) {
+					v = _mm_xor_si128(v, 
+						_mm_and_si128(mask, bit));
+					_mm_storeu_si128((__m128i *) s, v);
+				}
+				s   += 16;
+				len -= 16;
+				continue;
+			}
+		}
+#endif
+		if ((*s < 0x80) || ((n = utf8_decode(s, len, &cp)) == 0)) {
+			if (table[*s] != *s) {
+				changed++;
+				if (room) {
+					*s = table[*s];
+				}
+			}
+			s++;
+			len--;
+			continue;
+		}
+		if ((to = case_lookup(upper, cp)) != cp) {
+			changed++;
+			if (room) {
+				if ((m = utf8_encode(to, enc)) != n) {
+					if ((*room -= m - n) < 0) {
+						return -1;
+					}
+					memmove(s + m, s + n, len - n + 1);
+				}
+				memcpy(s, enc, m);
+				s += m - n;	/* skip the tail moved */
+			}
+		}
+		s   += n;
+		len -= n;
+	}
+	return changed;
+}
+
+int rename_lowercase(char *s, int len, int *room)
+{
+	return case_mapping((unsigned char *) s, len, 0, room);
+}
+
+int rename_uppercase(char *s, int len, int *room)
+{
+	return case_mapping((unsigned char *) s, len, 1, room);
+}
+
+/* return non-zero if the name would be changed by the case conversion */
+int rename_case_check(const char *s, int len, int upper)
+{
+	return case_mapping((unsigned char *) s, len, upper, NULL);
+}
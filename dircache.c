@@ -0,0 +1,378 @@
+/*  dircache.c - the persistent cache of the directories done
+
+    Copyright (C) 1998-2011  "Andy Xuming" <xuming@users.sourceforge.net>
+
+    This file is part of RENAME, a utility to help file renaming
+
+    RENAME is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    RENAME is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if STDC_HEADERS
+  #include <string.h>
+#endif
+
+#if HAVE_UNISTD_H
+  #include <sys/types.h>
+  #include <unistd.h>
+#endif
+
+#if HAVE_REGEX_H
+  #include <regex.h>
+#else
+  #include "regex.h"
+#endif
+
+#include "rename.h"
+
+/* A directory whose entries were all done by a ruleset needs no reading
+   again by the same ruleset while its mtime and ctime stay the same, since
+   any name coming, going or renamed in it would change them. Only its
+   subdirectories have to be visited, so their names are kept with it.
+
+   The file is a header, the records sorted by the device and the inode,
+   and the pool of the subdirectory names, each ended by '\0'. It's mapped
+   and searched in place, and written anew to a temporary file which is
+   renamed over it at last, with the records of this run merged in. It's
+   in the byte order of the machine, which is checked by the magic.
+
+   A directory changed in the same second as the run started, or a second
+   before, is not recorded since the file systems keep the times by the
+   clock tick; another change in the same tick would not move them. It's
+   read again by the next run, which records it. */
+#define DC_MAGIC	0x31434452584e4d52ULL	/* "RMNXRDC1" */
+
+typedef	struct	{
+	uint64_t	magic;
+	uint32_t	count;		/* of the records */
+	uint32_t	pool;		/* bytes of the names */
+} DCHEAD;
+
+typedef	struct	{
+	uint64_t	dev;
+	uint64_t	ino;
+	int64_t		mtime;		/* nanoseconds */
+	int64_t		ctime;
+	uint64_t	hash;		/* of the ruleset */
+	uint32_t	subs;		/* offset of the names in the pool */
+	uint32_t	nsub;
+	int32_t		depth;		/* below the command line name */
+	uint32_t	reserved;
+} DCREC;
+
+struct	_RNMDCACHE	{
+	char		*path;
+	time_t		start;		/* the racy guard */
+
+	void		*map;		/* the last run, or NULL */
+	size_t		size;
+	DCREC		*old;
+	uint32_t	old_num;
+	char		*old_pool;
+	uint32_t	old_pool_len;
+
+	DCREC		*rec;		/* this run */
+	uint32_t	rec_num;
+	uint32_t	rec_max;
+	char		*pool;
+	uint32_t	pool_len;
+	uint32_t	pool_max;
+};
+
+static int dc_save(struct _RNMDCACHE *dc);
+static int dc_cmp(const void *a, const void *b);
+static int dc_span(const char *pool, uint32_t len, const DCREC *rec);
+static int64_t dc_nsec(const struct timespec *ts);
+static int dc_grow(void **buf, uint32_t *max, uint32_t need, size_t unit);
+static int dc_write(int fd, const void *buf, size_t len);
+
+
+/* the cache of 'path'; a missing or unreadable file is an empty cache */
+int rename_dircache_open(RENOP *opt, const char *path)
+{
+	struct	_RNMDCACHE	*dc;
+	struct	stat	fs;
+	DCHEAD	*head;
+	int	fd;
+
+	if ((dc = calloc(1, sizeof(struct _RNMDCACHE))) == NULL) {
+		return RNM_ERR_LOWMEM;
+	}
+	if ((dc->path = strdup(path)) == NULL) {
+		free(dc);
+		return RNM_ERR_LOWMEM;
+	}
+	dc->start = time(NULL);
+	opt->dircache = dc;
+
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+		return RNM_ERR_NONE;
+	}
+	if (!fstat(fd, &fs) && (fs.st_size >= (off_t) sizeof(DCHEAD))) {
+		dc->map = mmap(NULL, fs.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (dc->map == MAP_FAILED) {
+			dc->map = NULL;
+		}
+	}
+	close(fd);
+	if (dc->map == NULL) {
+		return RNM_ERR_NONE;
+	}
+	dc->size = fs.st_size;
+	head = dc->map;
+	if ((head->magic != DC_MAGIC) || (sizeof(DCHEAD) +
+			(size_t) head->count * sizeof(DCREC) + head->pool !=
+			dc->size) || (head->pool &&
+			(((char *) dc->map)[dc->size - 1] != 0))) {
+		munmap(dc->map, dc->size);
+		dc->map = NULL;		/* not ours, or broken */
+		return RNM_ERR_NONE;
+	}
+	dc->old      = (DCREC *)(head + 1);
+	dc->old_num  = head->count;
+	dc->old_pool = (char *)(dc->old + dc->old_num);
+	dc->old_pool_len = head->pool;
+	return RNM_ERR_NONE;
+}
+
+/* write the records of this run with the ones of the last run which were
+   not replaced, then drop the cache */
+int rename_dircache_close(RENOP *opt)
+{
+	struct	_RNMDCACHE	*dc = opt->dircache;
+	int	rc = RNM_ERR_NONE;
+
+	if (dc == NULL) {
+		return RNM_ERR_NONE;
+	}
+	if (dc->rec_num) {
+		rc = dc_save(dc);
+	}
+	if (dc->map) {
+		munmap(dc->map, dc->size);
+	}
+	free(dc->rec);
+	free(dc->pool);
+	free(dc->path);
+	free(dc);
+	opt->dircache = NULL;
+	return rc;
+}
+
+/* the names of the subdirectories to visit if the directory was done and
+   not changed since, or NULL. The names are back to back, '\0' ended */
+const char *rename_dircache_lookup(RENOP *opt, struct stat *fs, int *nsub)
+{
+	struct	_RNMDCACHE	*dc = opt->dircache;
+	DCREC	key, *rec;
+
+	if ((dc == NULL) || (dc->old_num == 0)) {
+		return NULL;
+	}
+	key.dev = fs->st_dev;
+	key.ino = fs->st_ino;
+	rec = bsearch(&key, dc->old, dc->old_num, sizeof(DCREC), dc_cmp);
+	if ((rec == NULL) || (rec->hash != opt->rule->hash) ||
+			(rec->depth != opt->depth) ||
+			(rec->mtime != dc_nsec(&fs->st_mtim)) ||
+			(rec->ctime != dc_nsec(&fs->st_ctim)) ||
+			(dc_span(dc->old_pool, dc->old_pool_len, rec) < 0)) {
+		return NULL;
+	}
+	*nsub = rec->nsub;
+	return dc->old_pool + rec->subs;
+}
+
+/* record the directory done with all its entries; 'subs' are the names of
+   the subdirectories visited, 'len' bytes with the '\0's */
+void rename_dircache_store(RENOP *opt, struct stat *fs, const char *subs,
+		int len, int nsub)
+{
+	struct	_RNMDCACHE	*dc = opt->dircache;
+	DCREC	*rec;
+
+	if ((dc == NULL) || (opt->cflags & RNM_CFLAG_TEST) ||
+			(fs->st_ctim.tv_sec >= dc->start - 1) ||
+			(fs->st_mtim.tv_sec >= dc->start - 1)) {
+		return;		/* racy, or nothing was done indeed */
+	}
+	if (dc_grow((void **) &dc->rec, &dc->rec_max, dc->rec_num + 1,
+				sizeof(DCREC)) ||
+			dc_grow((void **) &dc->pool, &dc->pool_max,
+				dc->pool_len + len, 1)) {
+		return;
+	}
+	rec = &dc->rec[dc->rec_num++];
+	memset(rec, 0, sizeof(DCREC));
+	rec->dev   = fs->st_dev;
+	rec->ino   = fs->st_ino;
+	rec->mtime = dc_nsec(&fs->st_mtim);
+	rec->ctime = dc_nsec(&fs->st_ctim);
+	rec->hash  = opt->rule->hash;
+	rec->depth = opt->depth;
+	rec->nsub  = nsub;
+	rec->subs  = dc->pool_len;
+	memcpy(dc->pool + dc->pool_len, subs, len);
+	dc->pool_len += len;
+}
+
+/* merge the sorted records of the last run and this run, this run's
+   winning, into a temporary file renamed over the cache at last */
+static int dc_save(struct _RNMDCACHE *dc)
+{
+	DCHEAD	head;
+	DCREC	*out, *rec;
+	char	*pool, *tmp, *src;
+	uint32_t	i, k, n = 0, plen = 0, srclen;
+	int	fd, c, len, rc = RNM_ERR_NONE;
+
+	qsort(dc->rec, dc->rec_num, sizeof(DCREC), dc_cmp);
+	out  = malloc((dc->old_num + dc->rec_num) * sizeof(DCREC));
+	pool = malloc(dc->old_pool_len + dc->pool_len + 1);
+	tmp  = malloc(strlen(dc->path) + 32);
+	if (!out || !pool || !tmp) {
+		free(out);
+		free(pool);
+		free(tmp);
+		return RNM_ERR_LOWMEM;
+	}
+	for (i = k = 0; (i < dc->old_num) || (k < dc->rec_num); ) {
+		c = (i == dc->old_num) ? 1 : (k == dc->rec_num) ? -1 :
+			dc_cmp(&dc->old[i], &dc->rec[k]);
+		if (c < 0) {
+			rec = &dc->old[i++];
+			src = dc->old_pool;
+			srclen = dc->old_pool_len;
+		} else {
+			i += (c == 0);		/* replaced */
+			rec = &dc->rec[k++];
+			src = dc->pool;
+			srclen = dc->pool_len;
+		}
+		/* a directory seen twice in the run is kept once */
+		if ((n && !dc_cmp(&out[n - 1], rec)) ||
+				((len = dc_span(src, srclen, rec)) < 0)) {
+			continue;
+		}
+		out[n] = *rec;
+		out[n].subs = plen;
+		memcpy(pool + plen, src + rec->subs, len);
+		plen += len;
+		n++;
+	}
+
+	head.magic = DC_MAGIC;
+	head.count = n;
+	head.pool  = plen;
+	sprintf(tmp, "%s.%d", dc->path, (int) getpid());
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if ((fd < 0) || dc_write(fd, &head, sizeof(head)) ||
+			dc_write(fd, out, n * sizeof(DCREC)) ||
+			dc_write(fd, pool, plen)) {
+		rc = RNM_ERR_OPENFILE;
+	}
+	if ((fd >= 0) && close(fd)) {
+		rc = RNM_ERR_OPENFILE;
+	}
+	if ((rc != RNM_ERR_NONE) || rename(tmp, dc->path)) {
+		unlink(tmp);
+		rc = RNM_ERR_OPENFILE;
+	}
+	free(out);
+	free(pool);
+	free(tmp);
+	return rc;
+}
+
+static int dc_cmp(const void *a, const void *b)
+{
+	const	DCREC	*x = a, *y = b;
+
+	if (x->dev != y->dev) {
+		return (x->dev < y->dev) ? -1 : 1;
+	}
+	if (x->ino != y->ino) {
+		return (x->ino < y->ino) ? -1 : 1;
+	}
+	return 0;
+}
+
+/* the bytes of the names of the record, or -1 if they run out of the
+   pool of 'len' bytes */
+static int dc_span(const char *pool, uint32_t len, const DCREC *rec)
+{
+	const	char	*p;
+	uint32_t	i, off = rec->subs;
+
+	for (i = 0; i < rec->nsub; i++) {
+		if ((off >= len) ||
+				((p = memchr(pool + off, 0, len - off)) == NULL)) {
+			return -1;
+		}
+		off = p - pool + 1;
+	}
+	return rec->nsub ? (int)(off - rec->subs) : 0;
+}
+
+static int64_t dc_nsec(const struct timespec *ts)
+{
+	return (int64_t) ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+static int dc_grow(void **buf, uint32_t *max, uint32_t need, size_t unit)
+{
+	uint32_t	n;
+	void	*p;
+
+	if (need <= *max) {
+		return 0;
+	}
+	for (n = *max ? *max : 1024; n < need; n *= 2);
+	if ((p = realloc(*buf, (size_t) n * unit)) == NULL) {
+		return -1;
+	}
+	*buf = p;
+	*max = n;
+	return 0;
+}
+
+static int dc_write(int fd, const void *buf, size_t len)
+{
+	const	char	*p = buf;
+	ssize_t	n;
+
+	while (len > 0) {
+		if ((n = write(fd, p, len)) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		p   += n;
+		len -= n;
+	}
+	return 0;
+}
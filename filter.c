@@ -0,0 +1,314 @@
+/*  filter.c - include, exclude and prune filters of the directory walk
+
+    Copyright (C) 1998-2011  "Andy Xuming" <xuming@users.sourceforge.net>
+
+    This file is part of RENAME, a utility to help file renaming
+
+    RENAME is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    RENAME is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#if STDC_HEADERS
+  #include <string.h>
+#endif
+
+#if HAVE_UNISTD_H
+  #include <sys/types.h>
+#endif
+
+#if HAVE_REGEX_H
+  #include <regex.h>
+#else
+  #include "regex.h"
+#endif
+
+#include "rename.h"
+
+/* Every filter is a set of globs which is compiled once before the walk.
+   The literal globs like ".git" and the suffix globs like "*.bak" go into
+   hash sets; the suffixes are looked up by the tails of the name for each
+   suffix length in use. All other globs are translated into one extended
+   regular expression of alternations, so a name is tested by one regexec()
+   at most, however many globs were given. */
+#define FILTER_MAXLEN	64	/* longest suffix glob kept in the hash */
+
+typedef	struct	{
+	char		**slot;
+	unsigned	mask;
+	int		used;
+} RNMSET;
+
+typedef	struct	{
+	RNMSET		literal;
+	RNMSET		suffix;
+	unsigned long long	suflen;		/* bitmap of suffix lengths */
+	char		*expr;		/* alternations before compiled */
+	int		ex_len;
+	int		compiled;
+	regex_t		preg[1];
+	int		count;
+} RNMGLOBS;
+
+struct	_RNMFILTER	{
+	RNMGLOBS	globs[RNM_FILTER_MAX];
+};
+
+
+static int set_insert(RNMSET *set, const char *key, int klen);
+static int set_lookup(RNMSET *set, const char *key, int klen);
+static int glob_to_regex(char *dest, const char *glob);
+
+
+int rename_filter_add(RNMRULE *rule, int type, const char *glob)
+{
+	RNMGLOBS	*gs;
+	const char	*p;
+	int	len;
+
+	if (rule->filter == NULL) {
+		if ((rule->filter = calloc(1, sizeof(struct _RNMFILTER)))
+				== NULL) {
+			return RNM_ERR_LOWMEM;
+		}
+	}
+	gs = &rule->filter->globs[type];
+	gs->count++;
+
+	len = strlen(glob);
+	if ((p = strpbrk(glob, "*?[\\")) == NULL) {
+		return set_insert(&gs->literal, glob, len);
+	}
+	if ((p == glob) && (*p == '*') && (len - 1 < FILTER_MAXLEN) &&
+			(strpbrk(glob + 1, "*?[\\") == NULL)) {
+		gs->suflen |= 1ULL << (len - 1);
+		return set_insert(&gs->suffix, glob + 1, len - 1);
+	}
+
+	/* the worst case is that every character is escaped */
+	p = gs->expr;
+	if ((gs->expr = realloc(gs->expr, gs->ex_len + len * 2 + 8)) == NULL) {
+		free((char *) p);
+		return RNM_ERR_LOWMEM;
+	}
+	if (gs->ex_len) {
+		gs->expr[gs->ex_len++] = '|';
+	}
+	gs->ex_len += glob_to_regex(gs->expr + gs->ex_len, glob);
+	return RNM_ERR_NONE;
+}
+
+int rename_filter_compile(RNMRULE *rule)
+{
+	RNMGLOBS	*gs;
+	char	*buf;
+	int	i, rc;
+
+	if (rule->filter == NULL) {
+		return RNM_ERR_NONE;
+	}
+	for (i = 0; i < RNM_FILTER_MAX; i++) {
+		gs = &rule->filter->globs[i];
+		if (gs->expr == NULL) {
+			continue;
+		}
+		if ((buf = malloc(gs->ex_len + 8)) == NULL) {
+			return RNM_ERR_LOWMEM;
+		}
+		sprintf(buf, "^(%.*s)$", gs->ex_len, gs->expr);
+		rc = regcomp(gs->preg, buf, REG_EXTENDED | REG_NOSUB);
+		free(buf);
+		if (rc) {
+			return RNM_ERR_REGPAT;
+		}
+		gs->compiled = 1;
+	}
+	return RNM_ERR_NONE;
+}
+
+void rename_filter_free(RNMRULE *rule)
+{
+	RNMGLOBS	*gs;
+	unsigned	k;
+	int	i;
+
+	if (rule->filter == NULL) {
+		return;
+	}
+	for (i = 0; i < RNM_FILTER_MAX; i++) {
+		gs = &rule->filter->globs[i];
+		for (k = 0; gs->literal.slot && (k <= gs->literal.mask); k++) {
+			free(gs->literal.slot[k]);
+		}
+		for (k = 0; gs->suffix.slot && (k <= gs->suffix.mask); k++) {
+			free(gs->suffix.slot[k]);
+		}
+		free(gs->literal.slot);
+		free(gs->suffix.slot);
+		free(gs->expr);
+		if (gs->compiled) {
+			regfree(gs->preg);
+		}
+	}
+	free(rule->filter);
+	rule->filter = NULL;
+}
+
+/* return the number of globs of the filter type */
+int rename_filter_count(const RNMRULE *rule, int type)
+{
+	return rule->filter ? rule->filter->globs[type].count : 0;
+}
+
+/* return 1 if the file name matches any glob of the filter type */
+int rename_filter_match(const RNMRULE *rule, int type, const char *name)
+{
+	RNMGLOBS	*gs;
+	unsigned long long	lens;
+	int	len, n;
+
+	if (rule->filter == NULL) {
+		return 0;
+	}
+	gs = &rule->filter->globs[type];
+	if (gs->count == 0) {
+		return 0;
+	}
+	len = strlen(name);
+	if (gs->literal.used && set_lookup(&gs->literal, name, len)) {
+		return 1;
+	}
+	for (lens = gs->suflen, n = 0; lens && (n <= len); lens >>= 1, n++) {
+		if ((lens & 1) &&
+				set_lookup(&gs->suffix, name + len - n, n)) {
+			return 1;
+		}
+	}
+	if (gs->compiled && !regexec(gs->preg, name, 0, NULL, 0)) {
+		return 1;
+	}
+	return 0;
+}
+
+static int set_insert(RNMSET *set, const char *key, int klen)
+{
+	RNMSET	grown;
+	unsigned	i, k;
+
+	if (set_lookup(set, key, klen)) {
+		return RNM_ERR_NONE;
+	}
+	if ((set->used + 1) * 2 > (int)(set->mask + 1)) {
+		/* keep the load under 50% */
+		grown.mask = set->slot ? set->mask * 2 + 1 : 15;
+		grown.used = 0;
+		if ((grown.slot = calloc(grown.mask + 1, sizeof(char *)))
+				== NULL) {
+			return RNM_ERR_LOWMEM;
+		}
+		for (k = 0; set->slot && (k <= set->mask); k++) {
+			if (set->slot[k] == NULL) {
+				continue;
+			}
+			i = rename_hash(set->slot[k], strlen(set->slot[k]));
+			for (i &= grown.mask; grown.slot[i];
+					i = (i + 1) & grown.mask);
+			grown.slot[i] = set->slot[k];
+			grown.used++;
+		}
+		free(set->slot);
+		*set = grown;
+	}
+	i = rename_hash(key, klen) & set->mask;
+	for ( ; set->slot[i]; i = (i + 1) & set->mask);
+	if ((set->slot[i] = malloc(klen + 1)) == NULL) {
+		return RNM_ERR_LOWMEM;
+	}
+	memcpy(set->slot[i], key, klen);
+	set->slot[i][klen] = 0;
+	set->used++;
+	return RNM_ERR_NONE;
+}
+
+static int set_lookup(RNMSET *set, const char *key, int klen)
+{
+	unsigned	i;
+
+	if (set->slot == NULL) {
+		return 0;
+	}
+	i = rename_hash(key, klen) & set->mask;
+	for ( ; set->slot[i]; i = (i + 1) & set->mask) {
+		if (!strncmp(set->slot[i], key, klen) &&
+				(set->slot[i][klen] == 0)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* translate the shell glob to the extended regular expression. It returns
+   the length of the expression, which is at most twice of the glob */
+static int glob_to_regex(char *dest, const char *glob)
+{
+	char	*p = dest;
+
+	for ( ; *glob; glob++) {
+		switch (*glob) {
+		case '*':
+			*p++ = '.';
+			*p++ = '*';
+			break;
+		case '?':
+			*p++ = '.';
+			break;
+		case '[':
+			*p++ = *glob++;
+			if ((*glob == '!') || (*glob == '^')) {
+				*p++ = '^';
+				glob++;
+			}
+			if (*glob == ']') {
+				*p++ = *glob++;
+			}
+			while (*glob && (*glob != ']')) {
+				*p++ = *glob++;
+			}
+			if (*glob == 0) {
+				glob--;
+			}
+			*p++ = ']';
+			break;
+		case '\\':
+			if (glob[1]) {
+				glob++;
+			}
+			/* fall through */
+		default:
+			if (strchr(".^$+(){}|\\[]", *glob)) {
+				*p++ = '\\';
+			}
+			*p++ = *glob;
+			break;
+		}
+	}
+	*p = 0;
+	return p - dest;
+}
@@ -0,0 +1,508 @@
+/*  librenamex.c - the library interface of the renaming engine
+
+    Copyright (C) 1998-2011  "Andy Xuming" <xuming@users.sourceforge.net>
+
+    This file is part of RENAME, a utility to help file renaming
+
+    RENAME is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    RENAME is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <grp.h>
+#include <pwd.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#if HAVE_UNISTD_H
+  #include <sys/types.h>
+  #include <unistd.h>
+#endif
+
+#if STDC_HEADERS
+  #include <string.h>
+#endif
+
+#if HAVE_REGEX_H
+  #include <regex.h>
+#else
+  #include "regex.h"
+#endif
+
+#include "rename.h"
+
+/* The ruleset holds the RNMRULE filled by the options, which every context
+   points to by renamex_open() and only reads, with the pattern, the compiled
+   regular expression and the filters. The option values are kept by the
+   ruleset since the pattern is split in place and pointed to. */
+struct	_RNMRULES	{
+	RNMRULE	rule;
+	int	slots;		/* of the name cache */
+	char	**held;		/* copies of the option values */
+	int	held_num;
+	int	compiled;
+};
+
+static	pthread_once_t	case_once = PTHREAD_ONCE_INIT;
+
+static	char	*errmsg[] = {
+	"Success",
+	"Help",
+	"Wrong parameters",
+	"Can not get the directory",
+	"Invalid user or group, or access denied",
+	"Out of memory",
+	"Wrong regular expression",
+	"Can not stat the file",
+	"Can not enter the directory",
+	"Can not open the directory",
+	"Path name too long",
+	"Can not open the file",
+	"Name buffer overflow",
+	"Can not rename the file",
+	"Can not change the ownership",
+	"Can not change the permission"
+};
+
+#ifdef	CFG_UNIX_API
+static int rules_owner(RNMRULE *rule, char *optarg);
+static int rules_group(RNMRULE *rule, char *optarg);
+static int rules_mode(RNMRULE *rule, char *optarg);
+static mode_t rules_umask(void);
+#endif
+static char *rules_hold(RNMRULES *rules, const char *value);
+static void rules_hash(RNMRULE *rule, const char *s);
+
+
+RNMRULES *renamex_rules_new(void)
+{
+	RNMRULES	*rules;
+
+	if ((rules = calloc(1, sizeof(RNMRULES))) == NULL) {
+		return NULL;
+	}
+	rules->rule.compare  = strncmp;
+	rules->rule.maxdepth = -1;
+	rules->rule.hash = 0xcbf29ce484222325ULL;
+	rules->slots = RNM_CACHE_SLOTS;
+	return rules;
+}
+
+/* set the rule by the long option of renamex(1) without the dashes, like
+   ("lowercase", NULL) or ("pattern", "/abc/xyz/gi") */
+int renamex_rules_set(RNMRULES *rules, const char *name, const char *value)
+{
+	RNMRULE	*rule = &rules->rule;
+	char	*arg = NULL;
+
+	if (rules->compiled) {
+		return RNM_ERR_PARAM;
+	}
+	if (value && ((arg = rules_hold(rules, value)) == NULL)) {
+		return RNM_ERR_LOWMEM;
+	}
+	/* the directory cache is kept by the rules which did the names */
+	if (strcmp(name, "cache") && strcmp(name, "verbose") &&
+			strcmp(name, "test-only")) {
+		rules_hash(rule, name);
+		rules_hash(rule, value ? value : "");
+	}
+
+	if (!strcmp(name, "lowercase")) {
+		rule->oflags &= ~RNM_OFLAG_MASKCASE;
+		rule->oflags |= RNM_OFLAG_LOWERCASE;
+	} else if (!strcmp(name, "uppercase")) {
+		rule->oflags &= ~RNM_OFLAG_MASKCASE;
+		rule->oflags |= RNM_OFLAG_UPPERCASE;
+	} else if (!strcmp(name, "nfc")) {
+		rule->oflags &= ~RNM_OFLAG_MASKNORM;
+		rule->oflags |= RNM_OFLAG_NFC;
+	} else if (!strcmp(name, "nfd")) {
+		rule->oflags &= ~RNM_OFLAG_MASKNORM;
+		rule->oflags |= RNM_OFLAG_NFD;
+	} else if (!strcmp(name, "recursive")) {
+		rule->cflags |= RNM_CFLAG_RECUR;
+	} else if (!strcmp(name, "verbose")) {
+		rule->cflags |= RNM_CFLAG_VERBOSE;
+	} else if (!strcmp(name, "test-only")) {
+		rule->cflags |= RNM_CFLAG_TEST;
+	} else if (!strcmp(name, "always")) {
+		rule->cflags &= ~RNM_CFLAG_PROMPT_MASK;
+		rule->cflags |= RNM_CFLAG_ALWAYS;
+	} else if (!strcmp(name, "never")) {
+		rule->cflags &= ~RNM_CFLAG_PROMPT_MASK;
+		rule->cflags |= RNM_CFLAG_NEVER;
+	} else if (!strcmp(name, "one-file-system")) {
+		rule->cflags |= RNM_CFLAG_XDEV;
+	} else if (arg == NULL) {
+		return RNM_ERR_PARAM;	/* the rest need the value */
+	} else if (!strcmp(name, "pattern")) {
+		if (rule->action == RNM_ACT_REGEX) {
+			regfree(rule->preg);	/* the last one wins */
+		}
+		rule->action = RNM_ACT_NONE;
+		return rename_pattern(rule, arg);
+#ifdef	CFG_UNIX_API
+	} else if (!strcmp(name, "owner")) {
+		return rules_owner(rule, arg);
+	} else if (!strcmp(name, "group")) {
+		return rules_group(rule, arg);
+	} else if (!strcmp(name, "mode")) {
+		return rules_mode(rule, arg);
+#endif
+	} else if (!strcmp(name, "include")) {
+		return *arg ? rename_filter_add(rule, RNM_FILTER_INCLUDE, arg)
+			: RNM_ERR_PARAM;
+	} else if (!strcmp(name, "exclude")) {
+		return *arg ? rename_filter_add(rule, RNM_FILTER_EXCLUDE, arg)
+			: RNM_ERR_PARAM;
+	} else if (!strcmp(name, "prune-dir")) {
+		return *arg ? rename_filter_add(rule, RNM_FILTER_PRUNE, arg)
+			: RNM_ERR_PARAM;
+	} else if (!strcmp(name, "max-depth")) {
+		rule->maxdepth = (int) strtol(arg, NULL, 0);
+	} else if (!strcmp(name, "min-depth")) {
+		rule->mindepth = (int) strtol(arg, NULL, 0);
+	} else if (!strcmp(name, "cache")) {
+		rules->slots = (int) strtol(arg, NULL, 0);
+	} else {
+		return RNM_ERR_PARAM;
+	}
+	return RNM_ERR_NONE;
+}
+
+/* It returns RNM_ERR_PARAM if the rules would do nothing */
+int renamex_rules_compile(RNMRULES *rules)
+{
+	int	rc;
+
+	if (rules->compiled) {
+		return RNM_ERR_NONE;
+	}
+	if (!rules->rule.oflags && !rules->rule.action) {
+		return RNM_ERR_PARAM;
+	}
+	if ((rc = rename_filter_compile(&rules->rule)) != RNM_ERR_NONE) {
+		return rc;
+	}
+	pthread_once(&case_once, rename_case_init);
+	rules->compiled = 1;
+	return RNM_ERR_NONE;
+}
+
+void renamex_rules_free(RNMRULES *rules)
+{
+	int	i;
+
+	if (rules == NULL) {
+		return;
+	}
+	if (rules->rule.action == RNM_ACT_REGEX) {
+		regfree(rules->rule.preg);
+	}
+	rename_filter_free(&rules->rule);
+	for (i = 0; i < rules->held_num; i++) {
+		free(rules->held[i]);
+	}
+	free(rules->held);
+	free(rules);
+}
+
+/* a context of the compiled rules. The 'cb' could be NULL, then nothing
+   is reported and the existing files are never overwritten unless the
+   rules said "always" */
+RNMCTX *renamex_open(const RNMRULES *rules, const RNMCALLBACK *cb)
+{
+	RENOP	*opt;
+
+	if (!rules->compiled || ((opt = calloc(1, sizeof(RENOP))) == NULL)) {
+		return NULL;
+	}
+	opt->rule   = &rules->rule;
+	opt->cflags = rules->rule.cflags;
+	rename_bucket_init(&opt->ops_tb, 0);
+	rename_bucket_init(&opt->dir_tb, 0);
+	opt->outfmt = RNM_OUT_TEXT;
+	rename_pool_init(&opt->jobs, RNM_JOB_SIZE);
+	if (cb) {
+		opt->cb = *cb;
+	}
+	if (rename_cache_open(opt, rules->slots) != RNM_ERR_NONE) {
+		free(opt);
+		return NULL;
+	}
+	return opt;
+}
+
+/* the 'path' is relative to the directory 'dfd', or the current directory
+   if 'dfd' is AT_FDCWD. It's only read */
+int renamex_rename(RNMCTX *ctx, int dfd, const char *path)
+{
+	return rename_entry(ctx, dfd, (char *) path);
+}
+
+/* wait for the jobs still running; it returns the first error of them */
+int renamex_finish(RNMCTX *ctx)
+{
+	return rename_finish(ctx);
+}
+
+unsigned long renamex_count(RNMCTX *ctx, int state)
+{
+	if ((state < 0) || (state >= RNM_REP_MAX)) {
+		return 0;
+	}
+	return ctx->stats.state[state];
+}
+
+void renamex_close(RNMCTX *ctx)
+{
+	if (ctx == NULL) {
+		return;
+	}
+	rename_sched_close(ctx);
+	rename_bucket_free(&ctx->ops_tb);
+	rename_bucket_free(&ctx->dir_tb);
+	rename_output_close(ctx);
+	rename_stats_free(&ctx->stats);
+	rename_cache_close(ctx);
+	rename_dircache_close(ctx);
+	rename_arena_free(&ctx->arena);
+	rename_pool_free(&ctx->jobs);
+	free(ctx->buffer);
+	free(ctx);
+}
+
+const char *renamex_strerror(int err)
+{
+	if ((err > 0) || (-err >= (int)(sizeof(errmsg) / sizeof(char *)))) {
+		return "Unknown error";
+	}
+	return errmsg[-err];
+}
+
+static char *rules_hold(RNMRULES *rules, const char *value)
+{
+	char	**held, *arg;
+
+	if ((arg = strdup(value)) == NULL) {
+		return NULL;
+	}
+	held = realloc(rules->held, (rules->held_num + 1) * sizeof(char *));
+	if (held == NULL) {
+		free(arg);
+		return NULL;
+	}
+	rules->held = held;
+	rules->held[rules->held_num++] = arg;
+	return arg;
+}
+
+/* FNV-1a of the options in order, with the '\0's as the separators */
+static void rules_hash(RNMRULE *rule, const char *s)
+{
+	do {
+		rule->hash ^= (unsigned char) *s;
+		rule->hash *= 0x100000001b3ULL;
+	} while (*s++);
+}
+
+#ifdef	CFG_UNIX_API
+/* OWNER is USER, USER:GROUP, USER: or :GROUP where the USER and the GROUP
+   could be the names or the numeric ids. A USER name alone changes the
+   group to its login group as well, but a numeric id changes the owner
+   only, since there is no user to look up. */
+static int rules_owner(RNMRULE *rule, char *optarg)
+{
+	struct	passwd	pwd, *result;
+	char	*buf, *group, *p;
+	size_t	bufsize;
+	int	rc = RNM_ERR_NONE;
+
+	if ((group = strchr(optarg, ':')) != NULL) {
+		*group++ = 0;
+	}
+	if (*optarg) {
+		rule->pw_uid = (uid_t) strtoul(optarg, &p, 10);
+	}
+	if (*optarg == 0) {
+		/* nothing to do with the owner */
+	} else if (*p == 0) {
+		rule->oflags |= RNM_OFLAG_OWNER;
+	} else {
+		bufsize = sysconf(_SC_GETPW_R_SIZE_MAX);
+		if (bufsize == -1) {		/* Value was indeterminate */
+			bufsize = 16384;	/* Should be more than enough */
+		}
+		if ((buf = malloc(bufsize)) == NULL) {
+			return RNM_ERR_LOWMEM;
+		}
+		if (getpwnam_r(optarg, &pwd, buf, bufsize, &result)) {
+			free(buf);
+			return RNM_ERR_EUID;
+		}
+		if (result == NULL) {
+			free(buf);
+			return RNM_ERR_EUID;
+		}
+		rule->pw_uid = pwd.pw_uid;
+		rule->pw_gid = pwd.pw_gid;
+		rule->oflags |= RNM_OFLAG_OWNER | RNM_OFLAG_GROUP;
+		free(buf);
+	}
+	if (group && *group) {
+		rc = rules_group(rule, group);
+	}
+
+	/* only the superuser could give the files away, while the owners
+	 * could change the group to one of their own groups */
+	if ((rule->oflags & RNM_OFLAG_OWNER) && (geteuid() != 0)) {
+		return RNM_ERR_EUID;
+	}
+	return rc;
+}
+
+static int rules_group(RNMRULE *rule, char *optarg)
+{
+	struct	group	grp, *result;
+	char	*buf, *p;
+	size_t	bufsize;
+
+	rule->pw_gid = (gid_t) strtoul(optarg, &p, 10);
+	if (*optarg && !*p) {
+		rule->oflags |= RNM_OFLAG_GROUP;
+		return RNM_ERR_NONE;
+	}
+
+	bufsize = sysconf(_SC_GETGR_R_SIZE_MAX);
+	if (bufsize == -1) {
+		bufsize = 16384;
+	}
+	if ((buf = malloc(bufsize)) == NULL) {
+		return RNM_ERR_LOWMEM;
+	}
+	if (getgrnam_r(optarg, &grp, buf, bufsize, &result)) {
+		free(buf);
+		return RNM_ERR_EUID;
+	}
+	if (result == NULL) {
+		free(buf);
+		return RNM_ERR_EUID;
+	}
+	rule->pw_gid = grp.gr_gid;
+	rule->oflags |= RNM_OFLAG_GROUP;
+	free(buf);
+	return RNM_ERR_NONE;
+}
+
+/* MODE is an octal number or the symbolic mode of chmod(1), for example
+   "u+rwX,go-w". The clauses are parsed once here and applied to the mode
+   of every file by the walk. Copying the bits like "g=u" is not supported.
+*/
+static int rules_mode(RNMRULE *rule, char *optarg)
+{
+	RNMMODE	*md;
+	mode_t	who, umsk;
+	char	*p;
+	long	n;
+
+	rule->md_num = 0;
+	if ((*optarg >= '0') && (*optarg <= '7')) {
+		n = strtol(optarg, &p, 8);
+		if (*p || (n > 07777)) {
+			return RNM_ERR_PARAM;
+		}
+		md = &rule->mode[rule->md_num++];
+		md->who = md->mask = 07777;
+		md->perm = (mode_t) n;
+		md->op = '=';
+		md->cond_x = 0;
+		rule->oflags |= RNM_OFLAG_MODE;
+		return RNM_ERR_NONE;
+	}
+
+	umsk = rules_umask();
+	for (p = optarg; *p; p++) {
+		for (who = 0; strchr("ugoa", *p) && *p; p++) {
+			switch (*p) {
+			case 'u': who |= 04700; break;
+			case 'g': who |= 02070; break;
+			case 'o': who |= 01007; break;
+			default:  who |= 07777; break;
+			}
+		}
+		if ((*p != '+') && (*p != '-') && (*p != '=')) {
+			return RNM_ERR_PARAM;
+		}
+		while ((*p == '+') || (*p == '-') || (*p == '=')) {
+			if (rule->md_num >= RNM_MODE_MAX) {
+				return RNM_ERR_PARAM;
+			}
+			md = &rule->mode[rule->md_num++];
+			md->who  = who ? who : 07777;
+			md->mask = who ? who : 07777 & ~umsk;
+			md->op   = *p++;
+			md->perm = 0;
+			md->cond_x = 0;
+			for ( ; *p && (*p != ',') && !strchr("+-=", *p); p++) {
+				switch (*p) {
+				case 'r': md->perm |= 0444; break;
+				case 'w': md->perm |= 0222; break;
+				case 'x': md->perm |= 0111; break;
+				case 'X': md->cond_x = 1; break;
+				case 's': md->perm |= 06000; break;
+				case 't': md->perm |= 01000; break;
+				default:
+					return RNM_ERR_PARAM;
+				}
+			}
+		}
+		if (*p == 0) {
+			break;
+		}
+	}
+	if (rule->md_num == 0) {
+		return RNM_ERR_PARAM;
+	}
+	rule->oflags |= RNM_OFLAG_MODE;
+	return RNM_ERR_NONE;
+}
+/* umask() can not be read without setting it, which races with the other
+   threads creating files, so Linux is asked first */
+static mode_t rules_umask(void)
+{
+	FILE	*fp;
+	char	line[128];
+	mode_t	umsk = (mode_t) -1;
+
+	if ((fp = fopen("/proc/self/status", "r")) != NULL) {
+		while (fgets(line, sizeof(line), fp)) {
+			if (!strncmp(line, "Umask:", 6)) {
+				umsk = (mode_t) strtol(line + 6, NULL, 8);
+				break;
+			}
+		}
+		fclose(fp);
+	}
+	if (umsk == (mode_t) -1) {
+		umsk = umask(0);
+		umask(umsk);
+	}
+	return umsk;
+}
+#endif	/* CFG_UNIX_API */
@@ -0,0 +1,105 @@
+/*  librenamex.h - the renaming engine as a library
+
+    Copyright (C) 1998-2011  "Andy Xuming" <xuming@users.sourceforge.net>
+
+    This file is part of RENAME, a utility to help file renaming
+
+    RENAME is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    RENAME is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef	_LIBRENAMEX_H_
+#define _LIBRENAMEX_H_
+
+/* A ruleset is built by the long options of renamex(1), without the
+   dashes, and compiled once:
+
+	RNMRULES *rules = renamex_rules_new();
+	renamex_rules_set(rules, "pattern", "/.jpeg/.jpg/s");
+	renamex_rules_set(rules, "lowercase", NULL);
+	renamex_rules_set(rules, "never", NULL);
+	renamex_rules_compile(rules);
+
+   A compiled ruleset is read-only and can be shared by any number of
+   threads. Each renaming call runs in a context of its own, which holds
+   the name buffer, the name cache and the counters:
+
+	RNMCTX *ctx = renamex_open(rules, &callbacks);
+	renamex_rename(ctx, dirfd, "Some.JPEG");
+	renamex_finish(ctx);
+	renamex_close(ctx);
+
+   The library keeps no global state and prints nothing. The results go to
+   the callbacks, which are called by the thread of the context. */
+
+#define RNM_ERR_NONE		0
+#define RNM_ERR_SKIP		1
+#define RNM_ERR_HELP		-1
+#define RNM_ERR_PARAM		-2	/* wrong (command line) parameters */
+#define RNM_ERR_GETDIR		-3	/* can not get directory name */
+#define RNM_ERR_EUID		-4	/* invalid user id */
+#define RNM_ERR_LOWMEM		-5	/* low memory */
+#define RNM_ERR_REGPAT		-6	/* wrong regex pattern */
+#define RNM_ERR_STAT		-7	/* failed to stat of the file */
+#define RNM_ERR_CHDIR		-8
+#define RNM_ERR_OPENDIR		-9
+#define RNM_ERR_LONGPATH	-10	/* path name is too long */
+#define RNM_ERR_OPENFILE	-11
+#define RNM_ERR_OVERFLOW	-12
+#define RNM_ERR_RENAME		-13
+#define RNM_ERR_CHOWN		-14
+#define RNM_ERR_CHMOD		-15
+
+#define RNM_REP_OK		0	/* the states of the reported files */
+#define RNM_REP_SKIP		1
+#define RNM_REP_TEST		2
+#define RNM_REP_FAILED		3
+#define RNM_REP_CHOWN		4
+#define RNM_REP_CHMOD		5
+#define RNM_REP_MAX		6
+
+#define RNM_ANS_NO		0	/* the answers of the conflict */
+#define RNM_ANS_YES		1
+#define RNM_ANS_ALWAYS		2	/* yes to this and all the rest */
+#define RNM_ANS_NEVER		3	/* no to this and all the rest */
+
+typedef	struct	_RNMRULES	RNMRULES;
+typedef	struct	_RENOP		RNMCTX;
+
+typedef	struct	{
+	/* a file was renamed, changed, tested, skipped or failed; 'err' is
+	 * the errno of RNM_REP_FAILED. The names are relative to 'dfd' */
+	void	(*report)(void *data, int dfd, const char *dest,
+			const char *sour, int state, int err);
+	/* the 'dest' exists and neither "always" nor "never" was set. It
+	 * returns one of RNM_ANS_*; without it the file is skipped */
+	int	(*conflict)(void *data, int dfd, const char *dest);
+	/* a directory could not be read */
+	void	(*error)(void *data, const char *path, int err);
+	void	*data;
+} RNMCALLBACK;
+
+RNMRULES *renamex_rules_new(void);
+int renamex_rules_set(RNMRULES *rules, const char *name, const char *value);
+int renamex_rules_compile(RNMRULES *rules);
+void renamex_rules_free(RNMRULES *rules);
+
+RNMCTX *renamex_open(const RNMRULES *rules, const RNMCALLBACK *cb);
+int renamex_rename(RNMCTX *ctx, int dfd, const char *path);
+int renamex_finish(RNMCTX *ctx);
+unsigned long renamex_count(RNMCTX *ctx, int state);
+void renamex_close(RNMCTX *ctx);
+
+const char *renamex_strerror(int err);
+
+#endif	/* _LIBRENAMEX_H_ */
@@ -23,11 +23,13 @@
 #include "config.h"
 #endif
 
-#include <ctype.h>
-#include <pwd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <signal.h>
+#include <termios.h>
 
 #if HAVE_UNISTD_H
   #include <sys/types.h>
@@ -55,8 +57,8 @@
 #define	WHOAMI	"renamex"
 #define VERSION	"1.99.1"
 
-static	char	cwd[SVRBUF];	/* current working directory */
-static	RENOP	sysopt;
+static	RNMRULES	*rules;
+static	RENOP	*sysopt;	/* the context, for the signal handler */
 
 static	char	*usage = "\
 Usage: " WHOAMI " [OPTIONS] filename ...\n\
@@ -64,6 +66,8 @@ OPTIONS:\n\
   -f, --file              Load file names from the file\n\
   -l, --lowercase         Lowercase the file name\n\
   -u, --uppercase         Uppercase the file name\n\
+      --nfc               Normalize the file name to Unicode NFC\n\
+      --nfd               Normalize the file name to Unicode NFD\n\
   -s/PATTERN/STRING[/SW]  Replace the matching PATTERN with STRING.\n\
                           The SW could be:\n\
                           [i] ignore case when searching\n\
@@ -73,16 +77,50 @@ OPTIONS:\n\
                           [e] PATTERN is extended regular expression\n\
                           [g] replace all occurrences in the filename\n\
                           [1-9] replace specified occurrences in the filename\n\
-  -R, --recursive         Operate on files and directories recursively\n"
+  -R, --recursive         Operate on files and directories recursively\n\
+      --include GLOB      Only rename the files matching GLOB\n\
+      --exclude GLOB      Skip the files and directories matching GLOB\n\
+      --prune-dir GLOB    Do not descend the directories matching GLOB\n\
+      --max-depth N       Descend at most N levels below the arguments\n\
+      --min-depth N       Do not rename files less than N levels below\n\
+  -x, --one-file-system   Do not descend directories on other file systems\n\
+  -j, --jobs N            Rename by N workers per file system (with -A/-N)\n\
+      --io-limit PATH:JOBS[:OPS]\n\
+                          Workers and operations per second on the file\n\
+                          system of PATH\n\
+      --max-ops-per-sec N Rename or chown at most N files per second\n\
+      --max-dirs-per-sec N\n\
+                          Read at most N directories per second\n\
+      --ionice CLASS      I/O scheduling class: idle or be[:0-7]\n"
 #ifdef	CFG_UNIX_API
-"  -o, --owner OWNER       Change file's ownership (superuser only)\n"
+"  -o, --owner OWNER       Change file's ownership to USER[:GROUP] or the\n\
+                          numeric UID[:GID] (superuser only)\n\
+      --group GROUP       Change file's group\n\
+      --mode MODE         Change file's permission by the octal or the\n\
+                          symbolic MODE like chmod(1)\n"
 #endif
 "  -v, --verbose           Display verbose information\n\
+      --output FORMAT     Write a record per file in FORMAT: text, jsonl,\n\
+                          tsv or nul\n\
+      --stats             Display the counters and the timings at last\n\
+      --latency           Display the latency percentiles of the system calls\n\
+      --latency-dump FILE Write the latency histograms to FILE\n\
+      --progress          Display a progress line every second instead\n\
+      --async-output      Write the verbose information by a thread\n\
   -t, --test              Test only mode. Do not change any thing\n\
   -h, --help              Display this help and exit\n\
   -V, --version           Output version information and exit\n\
   -A, --always            Always overwrite the existing files\n\
   -N, --never             Never overwrite the existing files\n\
+      --cache SIZE        Slots of the name transform cache (0 disables)\n\
+      --watch             Keep renaming the new files of the directories\n\
+                          and the subdirectories after the pass; needs -R\n\
+      --watch-delay MS    Rename the new files after MS milliseconds quiet\n\
+                          (200)\n\
+      --dir-cache FILE    Skip the directories unchanged since the last run\n\
+                          with the same rules, as recorded in FILE\n\
+      --serve SOCKET      Run as a daemon renaming by the requests on the\n\
+                          Unix socket SOCKET\n\
 \n\
 Please see manpage regex(7) for the details of extended regular expression.\n";
 
@@ -93,10 +131,13 @@ License GPLv3+: GNU GPL version 3 or later <http://gnu.org/licenses/gpl.html>\n\
 This is free software: you are free to change and redistribute it.\n\
 There is NO WARRANTY, to the extent permitted by law.\n";
 
-#ifdef	CFG_UNIX_API
-static int cli_set_owner(RENOP *opt, char *optarg);
-#endif
-static int cli_set_pattern(RENOP *opt, char *optarg);
+static int cli_set_rule(char *rule, char *optval);
+static int cli_needval(char *rule);
+static int cli_prompt(void *data, int dfd, const char *dest);
+static void cli_error(void *data, const char *path, int err);
+static int cli_set_iolimit(RENOP *opt, char *optarg);
+static int cli_set_ionice(char *optarg);
+static char *cli_optval(char *optval, int *argc, char ***argv);
 #ifdef	DEBUG
 static int cli_dump(RENOP *opt, char *filename);
 #endif
@@ -105,12 +146,30 @@ static void siegfried (int signum);
 int main(int argc, char **argv)
 {
 	struct	sigaction	signew, sigold;
-	int 	infile = 0, rc = RNM_ERR_NONE;
-
-	memset(&sysopt, 0, sizeof(RENOP));
-	sysopt.compare = strncmp;
+	RNMCALLBACK	cb;
+	FILE	*fp;
+	char	*optval, *p, *rule, *latdump = NULL, *serve = NULL, **iolimit;
+	char	*dircache = NULL;
+	int 	infile = 0, rc = RNM_ERR_NONE, i, io_num = 0, jobs = 0;
+	int	async = 0, progress = 0, outfmt = RNM_OUT_TEXT, stats = 0;
+	int	latency = 0, watch = 0, delay = 200;
+	double	wall = 0, cpu = 0, max_ops = 0, max_dirs = 0;
+
+	rules = renamex_rules_new();
+	iolimit = calloc(argc, sizeof(char *));
+	if ((rules == NULL) || (iolimit == NULL)) {
+		printf("Out of memory!\n");
+		return RNM_ERR_LOWMEM;
+	}
 	while (--argc && (**++argv == '-')) {
 		rc = RNM_ERR_NONE;
+		rule = NULL;	/* the option is a rule of the library */
+		/* the long options could be given as --option=value */
+		optval = NULL;
+		if (!strncmp(*argv, "--", 2) && ((p = strchr(*argv, '=')) != NULL)) {
+			*p = 0;
+			optval = p + 1;
+		}
 		if (!strcmp_list(*argv, "-h", "--help")) {
 			puts(usage);
 			rc = RNM_ERR_HELP;
@@ -120,58 +179,126 @@ int main(int argc, char **argv)
 		} else if (!strcmp_list(*argv, "-f", "--file")) {
 			infile = 1;
 		} else if (!strcmp_list(*argv, "-l", "--lowercase")) {
-			sysopt.oflags &= ~RNM_OFLAG_MASKCASE;
-			sysopt.oflags |= RNM_OFLAG_LOWERCASE;
+			rule = "lowercase";
 		} else if (!strcmp_list(*argv, "-u", "--uppercase")) {
-			sysopt.oflags &= ~RNM_OFLAG_MASKCASE;
-			sysopt.oflags |= RNM_OFLAG_UPPERCASE;
+			rule = "uppercase";
+		} else if (!strcmp(*argv, "--nfc")) {
+			rule = "nfc";
+		} else if (!strcmp(*argv, "--nfd")) {
+			rule = "nfd";
 		} else if (!strcmp_list(*argv, "-R", "--recursive")) {
-			sysopt.cflags |= RNM_CFLAG_RECUR;
+			rule = "recursive";
 		} else if (!strcmp_list(*argv, "-v", "--verbose")) {
-			sysopt.cflags |= RNM_CFLAG_VERBOSE;
+			rule = "verbose";
+		} else if (!strcmp(*argv, "--output")) {
+			if (((optval = cli_optval(optval, &argc, &argv)) == NULL)
+					|| ((outfmt = 
+					rename_output_format(optval)) < 0)) {
+				rc = RNM_ERR_PARAM;
+			}
+		} else if (!strcmp(*argv, "--stats")) {
+			stats = 1;
+		} else if (!strcmp(*argv, "--latency")) {
+			latency = 1;
+		} else if (!strcmp(*argv, "--latency-dump")) {
+			if ((latdump = cli_optval(optval, &argc, &argv)) == NULL) {
+				rc = RNM_ERR_PARAM;
+			} else {
+				latency = 1;
+			}
+		} else if (!strcmp(*argv, "--progress")) {
+			progress = 1;
+		} else if (!strcmp(*argv, "--async-output")) {
+			async = 1;
 		} else if (!strcmp_list(*argv, "-t", "--test-only")) {
-			sysopt.cflags |= RNM_CFLAG_TEST | RNM_CFLAG_VERBOSE;
+			rc = renamex_rules_set(rules, "verbose", NULL);
+			rule = "test-only";
 		} else if (!strcmp_list(*argv, "-A", "--always")) {
-			sysopt.cflags &= ~RNM_CFLAG_PROMPT_MASK;
-			sysopt.cflags |= RNM_CFLAG_ALWAYS;
+			rule = "always";
 		} else if (!strcmp_list(*argv, "-N", "--never")) {
-			sysopt.cflags &= ~RNM_CFLAG_PROMPT_MASK;
-			sysopt.cflags |= RNM_CFLAG_NEVER;
+			rule = "never";
 #ifdef	CFG_UNIX_API
 		} else if (!strcmp_list(*argv, "-o", "--owner")) {
-			if (--argc == 0) {
+			rule = "owner";
+		} else if (!strcmp(*argv, "--group")) {
+			rule = "group";
+		} else if (!strcmp(*argv, "--mode")) {
+			rule = "mode";
+#endif
+		} else if (!strcmp(*argv, "--cache")) {
+			rule = "cache";
+		} else if (!strcmp(*argv, "--max-depth")) {
+			rule = "max-depth";
+		} else if (!strcmp(*argv, "--min-depth")) {
+			rule = "min-depth";
+		} else if (!strcmp_list(*argv, "-x", "--one-file-system")) {
+			rule = "one-file-system";
+		} else if (!strcmp_list(*argv, "-j", "--jobs")) {
+			if ((optval = cli_optval(optval, &argc, &argv)) == NULL) {
 				rc = RNM_ERR_PARAM;
 			} else {
-				rc = cli_set_owner(&sysopt, *++argv);
+				jobs = (int) strtol(optval, NULL, 0);
 			}
-#endif
-		} else if (argv[0][1] == 's') {
-			if (argv[0][2] != 0) {
-				rc = cli_set_pattern(&sysopt, argv[0]+2);
-			} else if (--argc == 0) {
+		} else if (!strcmp(*argv, "--io-limit")) {
+			if ((optval = cli_optval(optval, &argc, &argv)) == NULL) {
 				rc = RNM_ERR_PARAM;
 			} else {
-				rc = cli_set_pattern(&sysopt, *++argv);
+				iolimit[io_num++] = optval;
+			}
+		} else if (!strcmp(*argv, "--max-ops-per-sec")) {
+			if ((optval = cli_optval(optval, &argc, &argv)) == NULL) {
+				rc = RNM_ERR_PARAM;
+			} else {
+				max_ops = strtod(optval, NULL);
+			}
+		} else if (!strcmp(*argv, "--max-dirs-per-sec")) {
+			if ((optval = cli_optval(optval, &argc, &argv)) == NULL) {
+				rc = RNM_ERR_PARAM;
+			} else {
+				max_dirs = strtod(optval, NULL);
+			}
+		} else if (!strcmp(*argv, "--watch")) {
+			watch = 1;
+		} else if (!strcmp(*argv, "--watch-delay")) {
+			if ((optval = cli_optval(optval, &argc, &argv)) == NULL) {
+				rc = RNM_ERR_PARAM;
+			} else {
+				delay = (int) strtol(optval, NULL, 0);
+			}
+		} else if (!strcmp(*argv, "--dir-cache")) {
+			if ((dircache = cli_optval(optval, &argc, &argv)) == NULL) {
+				rc = RNM_ERR_PARAM;
+			}
+		} else if (!strcmp(*argv, "--serve")) {
+			if ((serve = cli_optval(optval, &argc, &argv)) == NULL) {
+				rc = RNM_ERR_PARAM;
+			}
+		} else if (!strcmp(*argv, "--ionice")) {
+			rc = cli_set_ionice(cli_optval(optval, &argc, &argv));
+		} else if (!strcmp(*argv, "--include")) {
+			rule = "include";
+		} else if (!strcmp(*argv, "--exclude")) {
+			rule = "exclude";
+		} else if (!strcmp(*argv, "--prune-dir")) {
+			rule = "prune-dir";
+		} else if (argv[0][1] == 's') {
+			rule = "pattern";
+			if (argv[0][2] != 0) {
+				optval = argv[0] + 2;
 			}
 		} else {
 			printf("Unknown option. [%s]\n", *argv);
 			rc = RNM_ERR_PARAM;
 		}
+		if ((rc == RNM_ERR_NONE) && rule) {
+			rc = cli_set_rule(rule, cli_needval(rule) ?
+					cli_optval(optval, &argc, &argv) : NULL);
+		}
 		if (rc != RNM_ERR_NONE) {
 			return rc;
 		}
 	}
 
-	if ((argc < 1) || (!sysopt.oflags && !sysopt.action)) {
-		puts(usage);
-		return RNM_ERR_HELP;
-	}
-	
-	if (getcwd(cwd, SVRBUF) == NULL)  {
-		printf("Out of path!\n");
-		return RNM_ERR_GETDIR;
-	}
-    
 	signew.sa_handler = siegfried;
 	sigemptyset(&signew.sa_mask);
 	signew.sa_flags = 0;
@@ -189,143 +316,283 @@ int main(int argc, char **argv)
 		sigaction(SIGTERM, &signew, NULL);
 	}
 
+	/* the rules come with the requests then */
+	if (serve) {
+		free(iolimit);
+		renamex_rules_free(rules);
+		return rename_serve(serve);
+	}
+	if ((argc < 1) || 
+			((rc = renamex_rules_compile(rules)) == RNM_ERR_PARAM)) {
+		puts(usage);
+		return RNM_ERR_HELP;
+	}
+	if (rc != RNM_ERR_NONE) {
+		printf("Wrong filter pattern.\n");
+		return rc;
+	}
+
+	/* the reports are written by the context itself; see output.c */
+	memset(&cb, 0, sizeof(cb));
+	cb.conflict = cli_prompt;
+	cb.error    = cli_error;
+	if ((sysopt = renamex_open(rules, &cb)) == NULL) {
+		printf("Out of memory!\n");
+		return RNM_ERR_LOWMEM;
+	}
+	sysopt->outfmt = outfmt;
+	if (stats) {
+		sysopt->cflags |= RNM_CFLAG_STATS;
+	}
+	if (latency && ((rc = rename_stats_hist(&sysopt->stats)) != 
+				RNM_ERR_NONE)) {
+		return rc;
+	}
+	rename_bucket_init(&sysopt->ops_tb, max_ops);
+	rename_bucket_init(&sysopt->dir_tb, max_dirs);
+	if (jobs && ((rc = rename_sched_limit(sysopt, NULL, jobs, 0)) != 
+				RNM_ERR_NONE)) {
+		return rc;
+	}
+	for (i = 0; i < io_num; i++) {
+		if ((rc = cli_set_iolimit(sysopt, iolimit[i])) != RNM_ERR_NONE) {
+			return rc;
+		}
+	}
+	free(iolimit);
+	if (sysopt->sched && !(sysopt->cflags & RNM_CFLAG_PROMPT_MASK)) {
+		fprintf(stderr, "Renaming in parallel needs -A or -N, "
+				"running sequentially.\n");
+		rename_sched_close(sysopt);
+	}
+    
 #ifdef	DEBUG
-	if (sysopt.cflags & RNM_CFLAG_TEST) {
-		cli_dump(&sysopt, *argv);
+	if (sysopt->cflags & RNM_CFLAG_TEST) {
+		cli_dump(sysopt, *argv);
 	}
 #endif
+	if ((rc = rename_output_open(sysopt, 1, async, progress)) != 
+			RNM_ERR_NONE) {
+		return rc;
+	}
+	/* the attributes could be changed without touching the directory */
+	if (dircache && (sysopt->rule->oflags & RNM_OFLAG_MASKATTR)) {
+		fprintf(stderr, "The directory cache is not used with "
+				"--owner, --group or --mode.\n");
+	} else if (dircache && ((rc = rename_dircache_open(sysopt, dircache))
+				!= RNM_ERR_NONE)) {
+		return rc;
+	}
+	/* the new files are renamed as entries of the directories, so the
+	 * first pass has to rename the entries as well */
+	if (watch && !(sysopt->cflags & RNM_CFLAG_RECUR)) {
+		fprintf(stderr, "Watching needs -R; --max-depth 1 with it "
+				"watches the directories alone.\n");
+		return RNM_ERR_PARAM;
+	}
+	if (watch && (infile || ((rc = rename_watch_open(sysopt, argv, argc,
+						delay)) != RNM_ERR_NONE))) {
+		printf("Can not watch the directories.\n");
+		return infile ? RNM_ERR_PARAM : rc;
+	}
+	wall = rename_stats_clock();
+	cpu  = rename_stats_cpu();
 	while (argc-- && (rc == RNM_ERR_NONE))  {
 		if (infile) {
-			rc = rename_enfile(&sysopt, *argv++);
+			rc = rename_enfile(sysopt, *argv++);
 		} else {
-			rc = rename_entry(&sysopt, *argv++);
+			rc = renamex_rename(sysopt, AT_FDCWD, *argv++);
 		}
 	}
 
-	if (sysopt.action == RNM_ACT_REGEX) { 
-		regfree(sysopt.preg);
+	infile = renamex_finish(sysopt);
+	if (rc == RNM_ERR_NONE) {
+		rc = infile;
+	}
+	if (sysopt->dircache && (rename_dircache_close(sysopt) != 
+				RNM_ERR_NONE)) {
+		perror(dircache);
+	}
+	if (watch && (rc == RNM_ERR_NONE)) {
+		rc = rename_watch(sysopt);	/* until killed */
+	}
+	wall = rename_stats_clock() - wall;
+	cpu  = rename_stats_cpu() - cpu;
+	rename_sched_close(sysopt);
+	rename_output_close(sysopt);
+
+	/* keep the records of --output clean for the machines */
+	fp = (sysopt->outfmt == RNM_OUT_TEXT) ? stdout : stderr;
+	fprintf(fp, "%d files renamed.\n", sysopt->rpcnt);
+	if (sysopt->cache && (sysopt->cflags & RNM_CFLAG_VERBOSE)) {
+		fprintf(fp, "Name cache: %lu hits, %lu misses.\n", 
+				sysopt->stats.c_hit, sysopt->stats.c_miss);
+	}
+	if (sysopt->cflags & RNM_CFLAG_STATS) {
+		rename_stats_report(sysopt, fp, wall, cpu);
+	}
+	rename_stats_latency(sysopt, fp);
+	if (latdump && (rename_stats_dump(sysopt, latdump) != RNM_ERR_NONE)) {
+		perror(latdump);
 	}
-	printf("%d files renamed.\n", sysopt.rpcnt);
+	renamex_close(sysopt);
+	sysopt = NULL;
+	renamex_rules_free(rules);
 	return rc;
 }
 
-#ifdef	CFG_UNIX_API
-static int cli_set_owner(RENOP *opt, char *optarg)
+/* set the rule of the library; the errors worth a word are told here */
+static int cli_set_rule(char *rule, char *optval)
 {
-	struct	passwd	pwd, *result;
-	char	*buf;
-	size_t	bufsize;
-
-	if (geteuid() != 0) {
-		printf("Access denied!\n");
-		return RNM_ERR_EUID;
+	int	rc;
+
+	rc = renamex_rules_set(rules, rule, optval);
+	switch (rc) {
+	case RNM_ERR_NONE:
+	case RNM_ERR_PARAM:
+		break;
+	case RNM_ERR_REGPAT:
+		printf("Wrong regular expression. [%s]\n", optval);
+		break;
+	default:
+		printf("%s! [%s]\n", renamex_strerror(rc), optval);
+		break;
 	}
+	return rc;
+}
 
-	bufsize = sysconf(_SC_GETPW_R_SIZE_MAX);
-	if (bufsize == -1) {		/* Value was indeterminate */
-		bufsize = 16384;	/* Should be more than enough */
-	}
-	if ((buf = malloc(bufsize)) == NULL) {
-		return RNM_ERR_LOWMEM;
+/* the rules taking a value */
+static int cli_needval(char *rule)
+{
+	static	char	*flags[] = { "lowercase", "uppercase", "nfc", "nfd",
+		"recursive", "verbose", "test-only", "always", "never",
+		"one-file-system", NULL };
+	int	i;
+
+	for (i = 0; flags[i]; i++) {
+		if (!strcmp(rule, flags[i])) {
+			return 0;
+		}
 	}
-	if (getpwnam_r(optarg, &pwd, buf, bufsize, &result)) {
-		printf("Access failed!\n");
-		free(buf);
-		return RNM_ERR_EUID;
+	return 1;
+}
+
+static int cli_prompt(void *data, int dfd, const char *dest)
+{
+	char	buf[64];
+
+	fprintf(stderr, "Overwrite '%s'?  (Yes/No/Always/Skip) ", dest);
+	tcflush(0, TCIFLUSH);
+	if (read(0, buf, 64) <= 0) {
+		return RNM_ANS_NO;
 	}
-	if (result == NULL) {
-		printf("User not existed!\n");
-		free(buf);
-		return RNM_ERR_EUID;
+
+	switch (*(skip_space(buf)))  {
+	case 'a':
+	case 'A':
+		return RNM_ANS_ALWAYS;
+	case 's':
+	case 'S':
+		return RNM_ANS_NEVER;
+	case 'y':
+	case 'Y':
+		return RNM_ANS_YES;
 	}
+	return RNM_ANS_NO;
+}
 
-	opt->pw_uid = pwd.pw_uid;
-	opt->pw_gid = pwd.pw_gid;
-	opt->oflags |= RNM_OFLAG_OWNER;
-	free(buf);
-	return RNM_ERR_NONE;
+static void cli_error(void *data, const char *path, int err)
+{
+	fprintf(stderr, "%s: %s\n", path, strerror(err));
 }
-#endif	/* CFG_UNIX_API */
 
-static int cli_set_pattern(RENOP *opt, char *optarg)
+/* PATH:JOBS[:OPS] sets the workers and the operations per second on the
+   file system of PATH. The PATH itself may have colons. */
+static int cli_set_iolimit(RENOP *opt, char *optarg)
 {
-	char	*idx[4], *p; 
-	int	cflags = 0;
+	char	*p, *q, *end;
+	double	ops = 0;
+	int	jobs, rc;
 
-	/* skip the first separater */
-	if ((*optarg == '/') || (*optarg == ':')) {
-		optarg++;
+	if ((optarg == NULL) || ((p = strrchr(optarg, ':')) == NULL)) {
+		return RNM_ERR_PARAM;
 	}
-	
-	fixtoken(optarg, idx, 4, "/:");
-    	opt->pattern = idx[0];
-	opt->substit = idx[1];
-
-	if (!opt->pattern || !opt->substit) {
+	*p++ = 0;
+	jobs = (int) strtol(p, &end, 0);
+	if ((*end == 0) && ((q = strrchr(optarg, ':')) != NULL)) {
+		ops = strtod(p, &end);
+		jobs = (int) strtol(q + 1, &end, 0);
+		if (*end == 0) {
+			*q = 0;
+		} else {	/* the last colon was part of the path */
+			q[0] = ':';
+			jobs = (int) ops;
+			ops = 0;
+		}
+	}
+	if ((jobs < 1) || (*optarg == 0)) {
 		return RNM_ERR_PARAM;
 	}
+	if ((rc = rename_sched_limit(opt, optarg, jobs, ops)) == RNM_ERR_STAT) {
+		printf("Can not find the file system of [%s]\n", optarg);
+	}
+	return rc;
+}
 
-	opt->pa_len = strlen(opt->pattern);
-	opt->su_len = strlen(opt->substit);
-	opt->action = RNM_ACT_FORWARD;
-	opt->count = 1;		/* default replace once */
-    	for (p = idx[2]; p && *p; p++)  {
-		switch (*p)  {
-		case 'g':
-		case 'G':
-			opt->count = 0;	/* 0 = unlimit */
-			break;
-		case 'b':
-		case 'B':
-			opt->action = RNM_ACT_BACKWARD;
-			break;
-		case 's':
-		case 'S':
-	    		opt->action = RNM_ACT_SUFFIX;
-	    		break;
-		case 'i':
-		case 'I':
-			cflags |= REG_ICASE;
-			opt->compare = strncasecmp;
-			break;
-		case 'r':
-		case 'R':
-			opt->action = RNM_ACT_REGEX;
-			break;
-		case 'e':
-		case 'E':
-	    		opt->action = RNM_ACT_REGEX;
-			cflags |= REG_EXTENDED;
-			break;
-		default:
-			if (isdigit((int) *p)) {
-				opt->count = *p - '0';
-			}
-			break;
-		}
+/* idle, or be[:LEVEL] for the best-effort class of the I/O scheduler */
+static int cli_set_ionice(char *optarg)
+{
+	int	ioclass, level = 4;
+
+	if (optarg == NULL) {
+		return RNM_ERR_PARAM;
 	}
-	if (opt->action == RNM_ACT_REGEX) {
-		if (regcomp(opt->preg, opt->pattern, cflags))  {
-			printf("Wrong regular expression. [%s]\n", 
-					opt->pattern);
-			return RNM_ERR_REGPAT;
+	if (!strcmp(optarg, "idle")) {
+		ioclass = RNM_IOPRIO_IDLE;
+	} else if (!strncmp(optarg, "be", 2) && 
+			((optarg[2] == 0) || (optarg[2] == ':'))) {
+		ioclass = RNM_IOPRIO_BE;
+		if (optarg[2] == ':') {
+			level = (int) strtol(optarg + 3, NULL, 0);
 		}
+		if ((level < 0) || (level > 7)) {
+			return RNM_ERR_PARAM;
+		}
+	} else {
+		return RNM_ERR_PARAM;
+	}
+	if (rename_ioprio(ioclass, level) != RNM_ERR_NONE) {
+		/* not fatal, the renaming is just not that polite */
+		fprintf(stderr, "Can not set the I/O priority.\n");
 	}
 	return RNM_ERR_NONE;
 }
 
+/* the value of a long option is either glued by '=' or the next argument */
+static char *cli_optval(char *optval, int *argc, char ***argv)
+{
+	if (optval) {
+		return optval;
+	}
+	if (--*argc == 0) {
+		return NULL;
+	}
+	return *++*argv;
+}
+
 #ifdef	DEBUG
 static int cli_dump(RENOP *opt, char *filename)
 {
 	printf("Source:         %s\n", filename);
 	printf("Flags:          OF=%x CF=%x ACT=%d\n", 
-			opt->oflags, opt->cflags, opt->action);
+			opt->rule->oflags, opt->cflags, opt->rule->action);
 	printf("Owership:       UID=%d GID=%d\n",
-			(int)opt->pw_uid, (int)opt->pw_gid);
-	printf("Pattern:        %s (%d)\n", opt->pattern, opt->pa_len);
-	printf("Substituter:    %s (%d+%d)\n", 
-			opt->substit, opt->su_len, opt->count);
-	printf("Name Buffer:    %d (%d)\n", opt->room, FNBUF);
+			(int)opt->rule->pw_uid, (int)opt->rule->pw_gid);
+	printf("Pattern:        %s (%d)\n", opt->rule->pattern,
+			opt->rule->pa_len);
+	printf("Substituter:    %s (%d+%d)\n", opt->rule->substit,
+			opt->rule->su_len, opt->rule->count);
+	printf("Name Buffer:    %d (%d)\n", opt->room, opt->bufsize);
 	printf("\n");
 	return 0;
 }
@@ -335,11 +602,8 @@ static int cli_dump(RENOP *opt, char *filename)
 /* Zis is KAOS! */
 static void siegfried (int signum)
 {
-	if (sysopt.action == RNM_ACT_REGEX) {
-		regfree(sysopt.preg);
-	}
-	if (chdir(cwd) < 0) {	/* kill the warning */
-		perror("chdir");
+	if (sysopt) {
+		rename_output_abort(sysopt);
 	}
 	exit(signum);
 }
@@ -0,0 +1,246 @@
+/*  match.c - search and substitute the patterns in the file names
+
+    Copyright (C) 1998-2011  "Andy Xuming" <xuming@users.sourceforge.net>
+
+    This file is part of RENAME, a utility to help file renaming
+
+    RENAME is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    RENAME is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <ctype.h>
+#include <pthread.h>
+#include <stdio.h>
+
+#if STDC_HEADERS
+  #include <string.h>
+#endif
+
+#if HAVE_UNISTD_H
+  #include <sys/types.h>
+#endif
+
+#if HAVE_REGEX_H
+  #include <regex.h>
+#else
+  #include "regex.h"
+#endif
+
+#include "rename.h"
+
+/* The matchers work on the name in place and only read the rule, so any
+   number of threads could match by the same rule, and they can be driven
+   without any file system by bench/matchbench.c. The name buffer must have
+   '*room' bytes free after the string, which is taken as the name grows. */
+
+/* compile the -s/PATTERN/STRING/SW argument into the rule. The argument
+   is split in place so it must stay alive */
+int rename_pattern(RNMRULE *rule, char *optarg)
+{
+	char	*idx[4], *p; 
+	int	cflags = 0;
+
+	/* skip the first separater */
+	if ((*optarg == '/') || (*optarg == ':')) {
+		optarg++;
+	}
+	
+	fixtoken(optarg, idx, 4, "/:");
+    	rule->pattern = idx[0];
+	rule->substit = idx[1];
+
+	if (!rule->pattern || !rule->substit) {
+		return RNM_ERR_PARAM;
+	}
+
+	rule->pa_len = strlen(rule->pattern);
+	rule->su_len = strlen(rule->substit);
+	rule->action = RNM_ACT_FORWARD;
+	rule->count = 1;		/* default replace once */
+    	for (p = idx[2]; p && *p; p++)  {
+		switch (*p)  {
+		case 'g':
+		case 'G':
+			rule->count = 0;	/* 0 = unlimit */
+			break;
+		case 'b':
+		case 'B':
+			rule->action = RNM_ACT_BACKWARD;
+			break;
+		case 's':
+		case 'S':
+	    		rule->action = RNM_ACT_SUFFIX;
+	    		break;
+		case 'i':
+		case 'I':
+			cflags |= REG_ICASE;
+			rule->compare = strncasecmp;
+			break;
+		case 'r':
+		case 'R':
+			rule->action = RNM_ACT_REGEX;
+			break;
+		case 'e':
+		case 'E':
+	    		rule->action = RNM_ACT_REGEX;
+			cflags |= REG_EXTENDED;
+			break;
+		default:
+			if (isdigit((int) *p)) {
+				rule->count = *p - '0';
+			}
+			break;
+		}
+	}
+	if (rule->action == RNM_ACT_REGEX) {
+		if (regcomp(rule->preg, rule->pattern, cflags))  {
+			return RNM_ERR_REGPAT;
+		}
+	}
+	return RNM_ERR_NONE;
+}
+
+/* to match a null-terminated string against the precompiled pattern buffer.
+   When successed, it substitutes matches with the second parameter so
+   the original string with enough buffer will be modified.
+   Note: precompiled pattern buffer be set to globel.
+   If no matches in the string, return 0.
+*/
+int match_regexpr(const RNMRULE *rule, char *fname, int flen, int *room)
+{
+	regmatch_t	pmatch[1];
+	int		count = 0;
+
+	while (!regexec(rule->preg, fname, 1, pmatch, 0))  {
+		*room = inject(fname + pmatch->rm_so, flen - pmatch->rm_so,
+				pmatch->rm_eo - pmatch->rm_so, *room,
+				rule->substit, rule->su_len);
+		if (*room < 0) {
+			return *room;
+		}
+		fname += pmatch->rm_so + rule->su_len;
+		flen  -= pmatch->rm_so - rule->su_len;
+		count++;
+		
+		if (flen <= 0) {
+			break;
+		}
+		if (rule->count && (count >= rule->count)) {
+			break;
+		}
+	}
+	return count;
+}
+
+int match_forward(const RNMRULE *rule, char *fname, int flen, int *room)
+{
+	int	count = 0;
+
+	if (rule->pa_len < 1) {
+		return 0;
+	}
+	while (flen >= rule->pa_len) {
+		if (rule->compare(fname, rule->pattern, rule->pa_len)) {
+			fname++;
+			flen--;
+			continue;
+		}
+
+		*room = inject(fname, flen, rule->pa_len, *room,
+				rule->substit, rule->su_len);
+		if (*room < 0) {
+			return *room;
+		}
+		count++;
+		flen += rule->su_len - rule->pa_len;
+
+		if (rule->count && (count >= rule->count)) {
+			break;
+		}
+		fname += rule->su_len;
+		flen  -= rule->su_len;
+	}
+	return count;
+}
+
+int match_backward(const RNMRULE *rule, char *fname, int flen, int *room)
+{
+	char	*fidx;
+	int	count = 0;
+
+	if (rule->pa_len < 1) {
+		return 0;
+	}
+
+	flen -= rule->pa_len;
+	fidx = fname + flen;
+	while (fidx >= fname) {
+		if (rule->compare(fidx, rule->pattern, rule->pa_len)) {
+			fidx--;
+			flen++;
+			continue;
+		}
+
+		*room = inject(fidx, flen, rule->pa_len, 
+				*room, rule->substit, rule->su_len);
+		if (*room < 0) {
+			return *room;
+		}
+		count++;
+		flen += rule->su_len - rule->pa_len;
+
+		if (rule->count && (count >= rule->count)) {
+			break;
+		}
+		fidx -= rule->pa_len;
+		flen += rule->pa_len;
+	}
+	return count;
+}
+
+int match_suffix(const RNMRULE *rule, char *fname, int flen, int *room)
+{
+	if ((rule->pa_len < 1) || (flen < rule->pa_len)) {
+		return 0;
+	}
+	if (rule->su_len - rule->pa_len > *room) {
+		return -1;	/* oversized */
+	}
+	fname += flen - rule->pa_len;
+	if (!rule->compare(fname, rule->pattern, rule->pa_len)) {
+		strcpy(fname, rule->substit);
+		*room -= rule->su_len - rule->pa_len;
+		return 1;
+	}
+	return 0;
+}
+
+int inject(char *rec, int rlen, int del, int room, char *in, int ilen)
+{
+	char	*sour;
+	int	acc;
+
+	sour = rec + del;
+	if ((acc = ilen - del) != 0) {
+		if ((room -= acc) < 0) {
+			return room;
+		}
+		memmove(sour + acc, sour, rlen - del + 1);
+	}
+	memcpy(rec, in, ilen);
+	return room;
+}
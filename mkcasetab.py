@@ -0,0 +1,55 @@
+#!/usr/bin/env python3
+#
+#  mkcasetab.py - generate the UTF-8 case mapping tables for casemap.c
+#
+#  Usage: python3 mkcasetab.py > casetab.h
+#
+#  Only the simple (one to one) mappings outside ASCII are taken. Code points
+#  which are mapped by the same delta and are evenly spaced, like the
+#  alternating upper/lower pairs of Latin Extended-A, are merged into one
+#  range record so the tables stay small enough for a binary search.
+
+import sys
+import unicodedata
+
+def mapping(conv):
+    out = []
+    for cp in range(0x80, 0x110000):
+        if 0xD800 <= cp <= 0xDFFF:
+            continue
+        ch = chr(cp)
+        to = conv(ch)
+        if len(to) != 1 or to == ch:
+            continue
+        out.append((cp, ord(to) - cp))
+    return out
+
+def ranges(pairs):
+    out = []
+    i = 0
+    while i < len(pairs):
+        first, delta = pairs[i]
+        count, stride = 1, 1
+        if i + 1 < len(pairs) and pairs[i+1][1] == delta and \
+                pairs[i+1][0] - first in (1, 2):
+            stride = pairs[i+1][0] - first
+            while i + count < len(pairs) and \
+                    pairs[i+count][1] == delta and \
+                    pairs[i+count][0] == first + count * stride and \
+                    count < 0xFFFF:
+                count += 1
+        out.append((first, count, stride, delta))
+        i += count
+    return out
+
+def dump(name, rec):
+    print("static const RNMCASE %s[%d] = {" % (name, len(rec)))
+    for first, count, stride, delta in rec:
+        print("\t{ 0x%05X, %5d, %d, %7d }," % (first, count, stride, delta))
+    print("};\n")
+
+print("/* casetab.h - generated by mkcasetab.py from Unicode %s, "
+        "do not edit */\n" % unicodedata.unidata_version)
+print("/* { first code point, count, stride, delta } */")
+dump("case_lower_map", ranges(mapping(str.lower)))
+dump("case_upper_map", ranges(mapping(str.upper)))
@@ -0,0 +1,100 @@
+#!/usr/bin/env python3
+#
+#  mknormtab.py - generate the Unicode normalization tables for normal.c
+#
+#  Usage: python3 mknormtab.py > normtab.h
+#
+#  The tables are:
+#    norm_ccc       ranges of the canonical combining classes (non-zero only)
+#    norm_nfd_qc    ranges of code points which are not allowed in NFD
+#    norm_nfc_qc    ranges of code points which are No (1) or Maybe (2) in NFC
+#    norm_decomp    full canonical decompositions, indexes into norm_pool
+#    norm_compose   primary composites sorted by the pair of code points
+#  The Hangul syllables are decomposed and composed by arithmetic in normal.c
+#  so they are left out of the decomposition and composition tables.
+
+import unicodedata
+
+HANGUL_FIRST, HANGUL_LAST = 0xAC00, 0xD7A3
+
+def chars():
+    for cp in range(0x110000):
+        if 0xD800 <= cp <= 0xDFFF:
+            continue
+        yield cp
+
+def runs(values):
+    """merge (cp, value) pairs of consecutive code points into ranges"""
+    out = []
+    for cp, val in values:
+        if out and out[-1][1] == cp - 1 and out[-1][2] == val:
+            out[-1][1] = cp
+        else:
+            out.append([cp, cp, val])
+    return out
+
+def canonical(cp):
+    d = unicodedata.decomposition(chr(cp))
+    if not d or d.startswith('<'):
+        return None
+    return [int(x, 16) for x in d.split()]
+
+ccc = [(cp, unicodedata.combining(chr(cp))) for cp in chars()
+        if unicodedata.combining(chr(cp))]
+
+decomp = {}
+compose = []
+for cp in chars():
+    if HANGUL_FIRST <= cp <= HANGUL_LAST:
+        continue
+    d = canonical(cp)
+    if d is None:
+        continue
+    decomp[cp] = [ord(c) for c in unicodedata.normalize('NFD', chr(cp))]
+    if len(d) == 2 and \
+            unicodedata.normalize('NFC', chr(d[0]) + chr(d[1])) == chr(cp):
+        compose.append((d[0], d[1], cp))
+compose.sort()
+
+seconds = set(c[1] for c in compose)
+seconds.update(range(0x1161, 0x1176))           # Hangul V
+seconds.update(range(0x11A8, 0x11C3))           # Hangul T
+
+nfd_qc = [(cp, 1) for cp in chars() if cp in decomp or
+        HANGUL_FIRST <= cp <= HANGUL_LAST]
+nfc_qc = []
+for cp in chars():
+    if unicodedata.normalize('NFC', chr(cp)) != chr(cp):
+        nfc_qc.append((cp, 1))
+    elif cp in seconds:
+        nfc_qc.append((cp, 2))
+
+print("/* normtab.h - generated by mknormtab.py from Unicode %s, "
+        "do not edit */\n" % unicodedata.unidata_version)
+
+def dump_ranges(name, rec):
+    print("static const RNMNRANGE %s[%d] = {" % (name, len(rec)))
+    for first, last, val in rec:
+        print("\t{ 0x%05X, 0x%05X, %3d }," % (first, last, val))
+    print("};\n")
+
+dump_ranges("norm_ccc", runs(ccc))
+dump_ranges("norm_nfd_qc", runs(nfd_qc))
+dump_ranges("norm_nfc_qc", runs(nfc_qc))
+
+pool = []
+print("static const RNMDECOMP norm_decomp[%d] = {" % len(decomp))
+for cp in sorted(decomp):
+    print("\t{ 0x%05X, %4d, %d }," % (cp, len(pool), len(decomp[cp])))
+    pool.extend(decomp[cp])
+print("};\n")
+
+print("static const unsigned norm_pool[%d] = {" % len(pool))
+for i in range(0, len(pool), 8):
+    print("\t" + " ".join("0x%05X," % c for c in pool[i:i+8]))
+print("};\n")
+
+print("static const RNMCOMPOSE norm_compose[%d] = {" % len(compose))
+for first, second, cp in compose:
+    print("\t{ 0x%05X, 0x%05X, 0x%05X }," % (first, second, cp))
+print("};\n")
@@ -0,0 +1,362 @@
+/*  normal.c - Unicode normalization (NFC/NFD) of the file names
+
+    Copyright (C) 1998-2011  "Andy Xuming" <xuming@users.sourceforge.net>
+
+    This file is part of RENAME, a utility to help file renaming
+
+    RENAME is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    RENAME is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#if STDC_HEADERS
+  #include <string.h>
+#endif
+
+#if HAVE_UNISTD_H
+  #include <sys/types.h>
+#endif
+
+#if HAVE_REGEX_H
+  #include <regex.h>
+#else
+  #include "regex.h"
+#endif
+
+#include "rename.h"
+
+/* The tables are generated by mknormtab.py. Bytes which are not valid
+   UTF-8 are carried through the normalization as the code points above
+   NORM_RAW, so they are written back untouched. */
+typedef	struct	{
+	unsigned	first;
+	unsigned	last;
+	int		value;
+} RNMNRANGE;
+
+typedef	struct	{
+	unsigned	cp;
+	unsigned short	index;		/* into norm_pool */
+	unsigned short	len;
+} RNMDECOMP;
+
+typedef	struct	{
+	unsigned	first;
+	unsigned	second;
+	unsigned	composite;
+} RNMCOMPOSE;
+
+#include "normtab.h"
+
+#define NORM_SIZE(t)	((int)(sizeof(t) / sizeof((t)[0])))
+#define NORM_RAW	0x110000
+#define NORM_MAXDEC	4		/* longest canonical decomposition */
+
+#define HANGUL_SBASE	0xAC00
+#define HANGUL_LBASE	0x1100
+#define HANGUL_VBASE	0x1161
+#define HANGUL_TBASE	0x11A7
+#define HANGUL_VCOUNT	21
+#define HANGUL_TCOUNT	28
+#define HANGUL_NCOUNT	(HANGUL_VCOUNT * HANGUL_TCOUNT)
+#define HANGUL_SCOUNT	(19 * HANGUL_NCOUNT)
+
+
+static int norm_range(const RNMNRANGE *tab, int n, unsigned cp)
+{
+	int	lo = 0, hi = n - 1, mid;
+
+	while (lo <= hi) {
+		mid = (lo + hi) / 2;
+		if (cp < tab[mid].first) {
+			hi = mid - 1;
+		} else if (cp > tab[mid].last) {
+			lo = mid + 1;
+		} else {
+			return tab[mid].value;
+		}
+	}
+	return 0;
+}
+
+static int norm_ccc_of(unsigned cp)
+{
+	if (cp < 0x300) {
+		return 0;
+	}
+	return norm_range(norm_ccc, NORM_SIZE(norm_ccc), cp);
+}
+
+static const RNMDECOMP *norm_decomp_of(unsigned cp)
+{
+	int	lo = 0, hi = NORM_SIZE(norm_decomp) - 1, mid;
+
+	while (lo <= hi) {
+		mid = (lo + hi) / 2;
+		if (cp < norm_decomp[mid].cp) {
+			hi = mid - 1;
+		} else if (cp > norm_decomp[mid].cp) {
+			lo = mid + 1;
+		} else {
+			return &norm_decomp[mid];
+		}
+	}
+	return NULL;
+}
+
+static unsigned norm_compose_of(unsigned first, unsigned second)
+{
+	int	lo = 0, hi = NORM_SIZE(norm_compose) - 1, mid;
+	unsigned	s;
+
+	/* Hangul LV and LVT syllables are composed by arithmetic */
+	if ((first >= HANGUL_LBASE) && (first < HANGUL_LBASE + 19) &&
+			(second >= HANGUL_VBASE) &&
+			(second < HANGUL_VBASE + HANGUL_VCOUNT)) {
+		return HANGUL_SBASE + ((first - HANGUL_LBASE) * HANGUL_VCOUNT +
+				second - HANGUL_VBASE) * HANGUL_TCOUNT;
+	}
+	s = first - HANGUL_SBASE;
+	if ((first >= HANGUL_SBASE) && (s < HANGUL_SCOUNT) &&
+			((s % HANGUL_TCOUNT) == 0) &&
+			(second > HANGUL_TBASE) &&
+			(second < HANGUL_TBASE + HANGUL_TCOUNT)) {
+		return first + second - HANGUL_TBASE;
+	}
+
+	while (lo <= hi) {
+		mid = (lo + hi) / 2;
+		if ((first < norm_compose[mid].first) ||
+				((first == norm_compose[mid].first) &&
+				 (second < norm_compose[mid].second))) {
+			hi = mid - 1;
+		} else if ((first > norm_compose[mid].first) ||
+				(second > norm_compose[mid].second)) {
+			lo = mid + 1;
+		} else {
+			return norm_compose[mid].composite;
+		}
+	}
+	return 0;
+}
+
+/* decode one UTF-8 character; invalid bytes are returned as NORM_RAW+byte */
+static int norm_decode(const unsigned char *s, int len, unsigned *cp)
+{
+	int	n, i;
+
+	if (*s < 0x80) {
+		*cp = *s;
+		return 1;
+	} else if ((*s >= 0xC2) && (*s < 0xE0)) {
+		n = 2;
+		*cp = *s & 0x1F;
+	} else if ((*s >= 0xE0) && (*s < 0xF0)) {
+		n = 3;
+		*cp = *s & 0x0F;
+	} else if ((*s >= 0xF0) && (*s < 0xF5)) {
+		n = 4;
+		*cp = *s & 0x07;
+	} else {
+		n = 0;
+	}
+	for (i = 1; (i < n) && (i < len); i++) {
+		if ((s[i] & 0xC0) != 0x80) {
+			break;
+		}
+		*cp = (*cp << 6) | (s[i] & 0x3F);
+	}
+	if ((n == 0) || (i < n) ||
+			((n == 3) && ((*cp < 0x800) ||
+			((*cp >= 0xD800) && (*cp <= 0xDFFF)))) ||
+			((n == 4) && ((*cp < 0x10000) || (*cp > 0x10FFFF)))) {
+		*cp = NORM_RAW + *s;
+		return 1;
+	}
+	return n;
+}
+
+static int norm_encode(unsigned cp, unsigned char *s)
+{
+	if (cp >= NORM_RAW) {
+		s[0] = cp - NORM_RAW;
+		return 1;
+	} else if (cp < 0x80) {
+		s[0] = cp;
+		return 1;
+	} else if (cp < 0x800) {
+		s[0] = 0xC0 | (cp >> 6);
+		s[1] = 0x80 | (cp & 0x3F);
+		return 2;
+	} else if (cp < 0x10000) {
+		s[0] = 0xE0 | (cp >> 12);
+		s[1] = 0x80 | ((cp >> 6) & 0x3F);
+		s[2] = 0x80 | (cp & 0x3F);
+		return 3;
+	}
+	s[0] = 0xF0 | (cp >> 18);
+	s[1] = 0x80 | ((cp >> 12) & 0x3F);
+	s[2] = 0x80 | ((cp >> 6) & 0x3F);
+	s[3] = 0x80 | (cp & 0x3F);
+	return 4;
+}
+
+/* the quick check of UAX #15. It returns 1 if the string is surely in the
+   normalization form already, or 0 if it has to be normalized to know.
+   A pure ASCII name always passes and costs only a scan. */
+int rename_norm_check(const char *s, int len, int nfd)
+{
+	const unsigned char	*p = (const unsigned char *) s;
+	unsigned	cp;
+	int	ccc, last = 0, n;
+
+	while (len > 0) {
+		if (*p < 0x80) {
+			last = 0;
+			p++;
+			len--;
+			continue;
+		}
+		n = norm_decode(p, len, &cp);
+		p   += n;
+		len -= n;
+		if (cp >= NORM_RAW) {
+			last = 0;
+			continue;
+		}
+		ccc = norm_ccc_of(cp);
+		if (ccc && (last > ccc)) {
+			return 0;
+		}
+		if (nfd) {
+			if (norm_range(norm_nfd_qc, NORM_SIZE(norm_nfd_qc), cp)) {
+				return 0;
+			}
+		} else if (norm_range(norm_nfc_qc, NORM_SIZE(norm_nfc_qc), cp)) {
+			return 0;	/* No or Maybe */
+		}
+		last = ccc;
+	}
+	return 1;
+}
+
+static int norm_decompose(unsigned cp, unsigned *out)
+{
+	const RNMDECOMP	*dec;
+	unsigned	s;
+	int	i;
+
+	s = cp - HANGUL_SBASE;
+	if ((cp >= HANGUL_SBASE) && (s < HANGUL_SCOUNT)) {
+		out[0] = HANGUL_LBASE + s / HANGUL_NCOUNT;
+		out[1] = HANGUL_VBASE + (s % HANGUL_NCOUNT) / HANGUL_TCOUNT;
+		if ((s % HANGUL_TCOUNT) == 0) {
+			return 2;
+		}
+		out[2] = HANGUL_TBASE + s % HANGUL_TCOUNT;
+		return 3;
+	}
+	if ((cp < 0xC0) || (cp >= NORM_RAW) ||
+			((dec = norm_decomp_of(cp)) == NULL)) {
+		out[0] = cp;
+		return 1;
+	}
+	for (i = 0; i < dec->len; i++) {
+		out[i] = norm_pool[dec->index + i];
+	}
+	return dec->len;
+}
+
+/* normalize the string 's' to NFD, or NFC if 'nfd' was 0, in place.
+   The 'room' is the free space after the string which could be consumed
+   when the normalized string became longer.
+   It returns 1 if the string was changed, 0 if not, or -1 if the room was
+   not enough, -2 if out of memory.
+*/
+int rename_normalize(char *s, int len, int nfd, int *room)
+{
+	unsigned char	*p = (unsigned char *) s, *out, *q;
+	unsigned	*cps, cp, tmp;
+	int	i, j, n, cnt, ccc, last, starter, olen;
+
+	/* every byte decomposes to two code points at most */
+	if ((cps = malloc(sizeof(unsigned) * (len * 2 + NORM_MAXDEC))) == NULL) {
+		return -2;
+	}
+	for (i = cnt = 0; i < len; i += n) {
+		n = norm_decode(p + i, len - i, &cp);
+		cnt += norm_decompose(cp, cps + cnt);
+	}
+
+	/* canonical ordering: stable sort the runs of non-starters */
+	for (i = 1; i < cnt; i++) {
+		if ((ccc = norm_ccc_of(cps[i])) == 0) {
+			continue;
+		}
+		for (j = i; (j > 0) && (norm_ccc_of(cps[j-1]) > ccc); j--) {
+			tmp = cps[j];
+			cps[j] = cps[j-1];
+			cps[j-1] = tmp;
+		}
+	}
+
+	if (!nfd && (cnt > 0)) {
+		starter = (norm_ccc_of(cps[0]) == 0) ? 0 : -1;
+		last = starter ? 256 : 0;
+		for (i = j = 1; i < cnt; i++) {
+			ccc = norm_ccc_of(cps[i]);
+			if ((starter >= 0) && ((last < ccc) || (last == 0)) &&
+				(cp = norm_compose_of(cps[starter], cps[i]))) {
+				cps[starter] = cp;
+				continue;
+			}
+			if (ccc == 0) {
+				starter = j;
+			}
+			last = ccc;
+			cps[j++] = cps[i];
+		}
+		cnt = j;
+	}
+
+	/* encode it back, the output is at most 4 bytes per code point */
+	if ((out = malloc(cnt * 4 + 1)) == NULL) {
+		free(cps);
+		return -2;
+	}
+	for (i = 0, q = out; i < cnt; i++) {
+		q += norm_encode(cps[i], q);
+	}
+	free(cps);
+
+	olen = q - out;
+	if ((olen == len) && !memcmp(out, s, len)) {
+		free(out);
+		return 0;
+	}
+	if ((*room -= olen - len) < 0) {
+		free(out);
+		return -1;
+	}
+	memcpy(s, out, olen);
+	s[olen] = 0;
+	free(out);
+	return 1;
+}
@@ -0,0 +1,525 @@
+/*  output.c - the buffered report output and the progress line
+
+    Copyright (C) 1998-2011  "Andy Xuming" <xuming@users.sourceforge.net>
+
+    This file is part of RENAME, a utility to help file renaming
+
+    RENAME is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    RENAME is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#if STDC_HEADERS
+  #include <string.h>
+#endif
+
+#if HAVE_UNISTD_H
+  #include <sys/types.h>
+  #include <unistd.h>
+#endif
+
+#if HAVE_REGEX_H
+  #include <regex.h>
+#else
+  #include "regex.h"
+#endif
+
+#include "rename.h"
+
+/* The report lines are collected in a big buffer and written by write(2)
+   when it's full, so a pipe or a slow terminal costs one system call per
+   block rather than per file. With the writer thread there are two buffers:
+   the full one is handed to the writer while the other one is being filled,
+   so the workers only wait for stdout when both buffers are full.
+   The progress thread prints the counters of the report states once per
+   second, and the per file lines are not printed at all. */
+#define OUTPUT_BUFSIZE	(256 * 1024)
+
+struct	_RNMOUTPUT	{
+	int		fd;
+	char		*buf[2];
+	int		used[2];
+	int		cur;		/* the buffer being filled */
+	int		pending;	/* the buffer handed to the writer */
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;
+	int		async;
+	int		quit;
+	pthread_t	writer;
+
+	int		progress;
+	pthread_t	ticker;
+	struct	timespec	start;
+	unsigned long	count[RNM_REP_MAX];
+};
+
+
+static void output_block(int fd, char *s, int len);
+static void output_drain(struct _RNMOUTPUT *out);
+static void *output_writer(void *arg);
+static void *output_ticker(void *arg);
+static void output_progress(struct _RNMOUTPUT *out);
+
+
+/* 'async' starts the writer thread, 'progress' starts the progress line
+   on stderr instead of the report lines */
+int rename_output_open(RENOP *opt, int fd, int async, int progress)
+{
+	struct	_RNMOUTPUT	*out;
+
+	if ((out = calloc(1, sizeof(struct _RNMOUTPUT))) == NULL) {
+		return RNM_ERR_LOWMEM;
+	}
+	fflush(stdout);		/* what was printed before goes first */
+	out->fd = fd;
+	out->pending = -1;
+	if ((out->buf[0] = malloc(OUTPUT_BUFSIZE * (async ? 2 : 1))) == NULL) {
+		free(out);
+		return RNM_ERR_LOWMEM;
+	}
+	out->buf[1] = out->buf[0] + OUTPUT_BUFSIZE;
+	pthread_mutex_init(&out->lock, NULL);
+	pthread_cond_init(&out->cond, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &out->start);
+	opt->output = out;
+
+	if (async && !pthread_create(&out->writer, NULL, output_writer, out)) {
+		out->async = 1;
+	}
+	if (progress && !pthread_create(&out->ticker, NULL,
+				output_ticker, out)) {
+		out->progress = 1;
+	}
+	return RNM_ERR_NONE;
+}
+
+/* write everything out and stop the threads */
+void rename_output_close(RENOP *opt)
+{
+	struct	_RNMOUTPUT	*out = opt->output;
+
+	if (out == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&out->lock);
+	out->quit = 1;
+	pthread_cond_broadcast(&out->cond);
+	pthread_mutex_unlock(&out->lock);
+	if (out->async) {
+		pthread_join(out->writer, NULL);
+	}
+	if (out->progress) {
+		pthread_join(out->ticker, NULL);
+	}
+	output_drain(out);
+
+	pthread_mutex_destroy(&out->lock);
+	pthread_cond_destroy(&out->cond);
+	free(out->buf[0]);
+	free(out);
+	opt->output = NULL;
+}
+
+/* write the buffered lines now, for example before a prompt */
+void rename_output_flush(RENOP *opt)
+{
+	if (opt->output) {
+		pthread_mutex_lock(&opt->output->lock);
+		output_drain(opt->output);
+		pthread_mutex_unlock(&opt->output->lock);
+	}
+}
+
+/* write what was buffered without waiting for anyone. It's only for the
+   signal handler when the process is going to die anyway */
+void rename_output_abort(RENOP *opt)
+{
+	struct	_RNMOUTPUT	*out = opt->output;
+
+	if (out) {
+		output_block(out->fd, out->buf[out->cur], out->used[out->cur]);
+	}
+}
+
+/* append the line to the buffer. It's safe to be called by the workers */
+void rename_output_write(RENOP *opt, const char *s, int len)
+{
+	struct	_RNMOUTPUT	*out = opt->output;
+
+	if (out == NULL) {
+		return;		/* a library context reports by callbacks */
+	}
+	pthread_mutex_lock(&out->lock);
+	if (len > OUTPUT_BUFSIZE) {
+		output_drain(out);
+		output_block(out->fd, (char *) s, len);	/* too big anyway */
+		pthread_mutex_unlock(&out->lock);
+		return;
+	}
+	if (out->used[out->cur] + len > OUTPUT_BUFSIZE) {
+		if (!out->async) {
+			output_drain(out);
+		} else {
+			while (out->pending >= 0) {
+				pthread_cond_wait(&out->cond, &out->lock);
+			}
+			out->pending = out->cur;
+			out->cur ^= 1;
+			out->used[out->cur] = 0;
+			pthread_cond_broadcast(&out->cond);
+		}
+	}
+	memcpy(out->buf[out->cur] + out->used[out->cur], s, len);
+	out->used[out->cur] += len;
+	pthread_mutex_unlock(&out->lock);
+}
+
+/* count the report state for the progress line, or nothing if the state
+   is -1. It returns non-zero if the report line should be printed */
+int rename_output_count(RENOP *opt, int state)
+{
+	if (opt->output == NULL) {
+		return 1;
+	}
+	if (state >= 0) {
+		__sync_fetch_and_add(&opt->output->count[state], 1);
+	}
+	return !opt->output->progress;
+}
+
+static void output_block(int fd, char *s, int len)
+{
+	int	n;
+
+	while (len > 0) {
+		if ((n = write(fd, s, len)) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;		/* nowhere to complain */
+		}
+		s   += n;
+		len -= n;
+	}
+}
+
+/* write the pending and the current buffers in order. It's called with the
+   output locked */
+static void output_drain(struct _RNMOUTPUT *out)
+{
+	while (out->pending >= 0) {
+		pthread_cond_wait(&out->cond, &out->lock);
+	}
+	output_block(out->fd, out->buf[out->cur], out->used[out->cur]);
+	out->used[out->cur] = 0;
+}
+
+static void *output_writer(void *arg)
+{
+	struct	_RNMOUTPUT	*out = arg;
+	int	n;
+
+	pthread_mutex_lock(&out->lock);
+	while (1) {
+		while ((out->pending < 0) && !out->quit) {
+			pthread_cond_wait(&out->cond, &out->lock);
+		}
+		if (out->pending < 0) {
+			break;
+		}
+		n = out->pending;
+		pthread_mutex_unlock(&out->lock);
+		output_block(out->fd, out->buf[n], out->used[n]);
+		pthread_mutex_lock(&out->lock);
+		out->used[n] = 0;
+		out->pending = -1;
+		pthread_cond_broadcast(&out->cond);
+	}
+	pthread_mutex_unlock(&out->lock);
+	return NULL;
+}
+
+static void *output_ticker(void *arg)
+{
+	struct	_RNMOUTPUT	*out = arg;
+	struct	timespec	tick;
+
+	pthread_mutex_lock(&out->lock);
+	clock_gettime(CLOCK_REALTIME, &tick);
+	while (!out->quit) {
+		tick.tv_sec++;
+		/* the condition is shared with the writer so it wakes up
+		 * more often than needed */
+		while (!out->quit && (pthread_cond_timedwait(&out->cond,
+					&out->lock, &tick) != ETIMEDOUT));
+		output_progress(out);
+	}
+	pthread_mutex_unlock(&out->lock);
+	if (isatty(2)) {
+		fputc('\n', stderr);
+	}
+	return NULL;
+}
+
+static void output_progress(struct _RNMOUTPUT *out)
+{
+	struct	timespec	now;
+	unsigned long	*cnt = out->count;
+	double	done, secs;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	secs = (now.tv_sec - out->start.tv_sec) +
+		(now.tv_nsec - out->start.tv_nsec) / 1e9;
+	done = cnt[RNM_REP_OK] + cnt[RNM_REP_TEST] + cnt[RNM_REP_CHOWN] +
+		cnt[RNM_REP_CHMOD];
+	fprintf(stderr, "%s%.0fs: %.0f done, %lu skipped, %lu failed, "
+			"%.0f files/s%s", isatty(2) ? "\r" : "", secs, done,
+			cnt[RNM_REP_SKIP], cnt[RNM_REP_FAILED],
+			secs > 0 ? done / secs : 0, isatty(2) ? "   " : "\n");
+}
+
+/* the name of --output to RNM_OUT_*, or -1 if unknown */
+int rename_output_format(const char *name)
+{
+	static	char	*formats[] = { "text", "jsonl", "tsv", "nul", NULL };
+	int	i;
+
+	for (i = 0; formats[i]; i++) {
+		if (!strcmp(name, formats[i])) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/* the records are serialized by hand rather than printf() since there is
+   one for every file renamed. The JSON strings keep the valid UTF-8 but
+   escape the other bytes as \u00XX, so the output is always valid JSON.
+   The TSV escapes the tab, the newline and the backslash. The NUL format
+   ends every field by '\0' so nothing has to be escaped at all. */
+static char *record_number(char *p, unsigned long n)
+{
+	char	tmp[24];
+	int	i = 0;
+
+	do {
+		tmp[i++] = '0' + n % 10;
+		n /= 10;
+	} while (n);
+	while (i) {
+		*p++ = tmp[--i];
+	}
+	return p;
+}
+
+/* the length of the valid UTF-8 sequence at 's', or 0 if invalid */
+static int record_utf8(const unsigned char *s)
+{
+	int	i, n;
+
+	if ((*s >= 0xC2) && (*s < 0xE0)) {
+		n = 2;
+	} else if ((*s >= 0xE0) && (*s < 0xF0)) {
+		n = 3;
+	} else if ((*s >= 0xF0) && (*s < 0xF5)) {
+		n = 4;
+	} else {
+		return 0;
+	}
+	for (i = 1; i < n; i++) {
+		if ((s[i] & 0xC0) != 0x80) {
+			return 0;
+		}
+	}
+	/* the overlong forms, the surrogates and above U+10FFFF */
+	if (((*s == 0xE0) && (s[1] < 0xA0)) || ((*s == 0xED) && 
+			(s[1] >= 0xA0)) || ((*s == 0xF0) && (s[1] < 0x90)) ||
+			((*s == 0xF4) && (s[1] >= 0x90))) {
+		return 0;
+	}
+	return n;
+}
+
+static char *record_json(char *p, const char *dir, const char *name)
+{
+	static	char	hex[] = "0123456789abcdef";
+	const unsigned char	*s;
+	int	i, n;
+
+	*p++ = '"';
+	for (i = dir ? 0 : 1; i < 2; i++) {
+		s = (const unsigned char *)(i ? name : dir);
+		for ( ; *s; s++) {
+			if ((*s == '"') || (*s == '\\')) {
+				*p++ = '\\';
+				*p++ = *s;
+				continue;
+			}
+			if ((*s >= 0x20) && (*s < 0x80)) {
+				*p++ = *s;
+				continue;
+			}
+			if ((n = record_utf8(s)) > 0) {
+				memcpy(p, s, n);
+				p += n;
+				s += n - 1;
+				continue;
+			}
+			memcpy(p, "\\u00", 4);
+			p[4] = hex[*s >> 4];
+			p[5] = hex[*s & 15];
+			p += 6;
+		}
+		if (i == 0) {
+			*p++ = '/';
+		}
+	}
+	*p++ = '"';
+	return p;
+}
+
+/* the path as a JSON string for the other writers, see serve.c. The 'p'
+   should have 6 bytes for every byte of the path and 2 for the quotes */
+char *rename_output_json(char *p, const char *path)
+{
+	return record_json(p, NULL, path);
+}
+
+static char *record_tsv(char *p, const char *dir, const char *name)
+{
+	const char	*s;
+	int	i;
+
+	for (i = dir ? 0 : 1; i < 2; i++) {
+		for (s = i ? name : dir; *s; s++) {
+			switch (*s) {
+			case '\t':
+				*p++ = '\\';
+				*p++ = 't';
+				break;
+			case '\n':
+				*p++ = '\\';
+				*p++ = 'n';
+				break;
+			case '\\':
+				*p++ = '\\';
+				*p++ = '\\';
+				break;
+			default:
+				*p++ = *s;
+				break;
+			}
+		}
+		if (i == 0) {
+			*p++ = '/';
+		}
+	}
+	return p;
+}
+
+static char *record_raw(char *p, const char *dir, const char *name)
+{
+	int	len;
+
+	if (dir) {
+		len = strlen(dir);
+		memcpy(p, dir, len);
+		p += len;
+		*p++ = '/';
+	}
+	len = strlen(name);
+	memcpy(p, name, len);
+	return p + len;
+}
+
+/* one record of the source and the destination path, the report state,
+   the errno and the microseconds spent on the file */
+void rename_output_record(RENOP *opt, RNMJOB *job, char *dest, char *sour,
+		int state, int err)
+{
+	static	char	*states[] = { "done", "skip", "test", "fail", "own", 
+		"mod" };
+	struct	timespec	now;
+	char	buf[4096], *rec, *p, *dir = job->dir->path;
+	unsigned long	usec;
+	int	len;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	usec = (now.tv_sec - job->start.tv_sec) * 1000000UL + 
+		(now.tv_nsec - job->start.tv_nsec) / 1000;
+
+	/* the worst case is every byte escaped to 6 bytes in JSON */
+	len = ((dir ? strlen(dir) + 1 : 0) * 2 + strlen(dest) + strlen(sour))
+		* 6 + 128;
+	if ((rec = (len <= (int) sizeof(buf)) ? buf : malloc(len)) == NULL) {
+		return;
+	}
+
+	p = rec;
+	switch (opt->outfmt) {
+	case RNM_OUT_JSONL:
+		memcpy(p, "{\"src\":", 7);
+		p = record_json(p + 7, dir, sour);
+		memcpy(p, ",\"dst\":", 7);
+		p = record_json(p + 7, dir, dest);
+		memcpy(p, ",\"state\":\"", 10);
+		p += 10;
+		strcpy(p, states[state]);
+		p += strlen(p);
+		memcpy(p, "\",\"errno\":", 10);
+		p = record_number(p + 10, err);
+		memcpy(p, ",\"usec\":", 8);
+		p = record_number(p + 8, usec);
+		*p++ = '}';
+		*p++ = '\n';
+		break;
+	case RNM_OUT_TSV:
+		p = record_tsv(p, dir, sour);
+		*p++ = '\t';
+		p = record_tsv(p, dir, dest);
+		*p++ = '\t';
+		strcpy(p, states[state]);
+		p += strlen(p);
+		*p++ = '\t';
+		p = record_number(p, err);
+		*p++ = '\t';
+		p = record_number(p, usec);
+		*p++ = '\n';
+		break;
+	default:
+		p = record_raw(p, dir, sour);
+		*p++ = 0;
+		p = record_raw(p, dir, dest);
+		*p++ = 0;
+		strcpy(p, states[state]);
+		p += strlen(p) + 1;
+		p = record_number(p, err);
+		*p++ = 0;
+		p = record_number(p, usec);
+		*p++ = 0;
+		break;
+	}
+	rename_output_write(opt, rec, p - rec);
+	if (rec != buf) {
+		free(rec);
+	}
+}
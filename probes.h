@@ -0,0 +1,56 @@
+/*  probes.h - the static tracepoints (USDT) of the renaming
+
+    Copyright (C) 1998-2011  "Andy Xuming" <xuming@users.sourceforge.net>
+
+    This file is part of RENAME, a utility to help file renaming
+
+    RENAME is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    RENAME is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef	_RENAME_PROBES_H_
+#define _RENAME_PROBES_H_
+
+/* The probes are the "renamex" provider of <sys/sdt.h> from SystemTap,
+   which perf, bpftrace and SystemTap all understand. A probe is a nop in
+   the code and a note in the ELF file, so it costs nothing unless a tracer
+   is attached. They are compiled out if the header was not found by the
+   Makefile. For example:
+
+	bpftrace -e 'usdt:./renamex:renamex:rename__done
+		{ printf("%s %d\n", str(arg1), arg2); }'
+
+   dir__enter	path, depth
+   dir__leave	path, result code
+   match__start	name
+   match__end	name, 1 if a job was made, 0 if not, or an error
+   rename__start	directory fd, source name, destination name
+   rename__done	directory fd, destination name, errno (0 if done)
+   chown__start	directory fd, name, uid, gid
+   chown__done	directory fd, name, errno (0 if done)
+*/
+#if HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define RNM_PROBE1(n,a)		DTRACE_PROBE1(renamex, n, a)
+#define RNM_PROBE2(n,a,b)	DTRACE_PROBE2(renamex, n, a, b)
+#define RNM_PROBE3(n,a,b,c)	DTRACE_PROBE3(renamex, n, a, b, c)
+#define RNM_PROBE4(n,a,b,c,d)	DTRACE_PROBE4(renamex, n, a, b, c, d)
+#else
+#define RNM_PROBE1(n,a)
+#define RNM_PROBE2(n,a,b)
+#define RNM_PROBE3(n,a,b,c)
+#define RNM_PROBE4(n,a,b,c,d)
+#endif
+
+#endif	/* _RENAME_PROBES_H_ */
@@ -24,11 +24,14 @@
 #endif
 
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <pwd.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <signal.h>
-#include <termios.h>
+#include <time.h>
 #include <sys/stat.h>
 
 #if HAVE_UNISTD_H
@@ -70,177 +73,630 @@
 #endif
 
 #include "rename.h"
+#include "probes.h"
   
 
-static	char	*rep_state[] = { "done", "skip", "test", "fail", "own" };
+static	char	*rep_state[] = { "done", "skip", "test", "fail", "own", "mod" };
+
+#define RNM_FILTER_NOACT	1	/* not included so do not rename */
+#define RNM_FILTER_NODIVE	2	/* pruned so do not descend */
+
+/* an entry of a directory read ahead, in the arena of the walk */
+typedef	struct	_WALKENT	{
+	struct	_WALKENT	*next;
+	unsigned char	type;		/* DT_UNKNOWN if not told */
+	unsigned char	descended;	/* visited as a subdirectory */
+	char	name[1];
+} WALKENT;
 
 static int rename_recursive(RENOP *opt, char *path);
-static int rename_action(RENOP *opt, char *oldname);
-static int rename_executing(RENOP *opt, char *dest, char *sour);
-static int rename_chown(RENOP *opt, char *fname);
-static int rename_prompt(RENOP *opt, char *fname);
-static int match_regexpr(RENOP *opt, char *fname, int flen);
-static int match_forward(RENOP *opt, char *fname, int flen);
-static int match_backward(RENOP *opt, char *fname, int flen);
-static int match_suffix(RENOP *opt, char *fname, int flen);
-static int match_lowercase(unsigned char *s);
-static int match_uppercase(unsigned char *s);
-static int inject(char *rec, int rlen, int del, int room, char *in, int ilen);
-static int report(char *dest, char *sour, int state, int flag);
+static int walk_lstat(RENOP *opt, int dfd, char *name, struct stat *fs);
+static int job_stat(RNMJOB *job, char *name, struct stat *fs, int flags);
+static struct dirent *walk_readdir(RENOP *opt, DIR *dir);
+static int walk_plan(RENOP *opt, DIR *dir, WALKENT **plan);
+static char *walk_subdirs(RENOP *opt, WALKENT *plan, int *len, int *nsub);
+static int rename_buffer(RENOP *opt, int size);
+static int rename_filtering(RENOP *opt, char *fname);
+static int rename_action(RENOP *opt, char *oldname, struct stat *fs);
+static int rename_matching(RENOP *opt, char *oldname, struct stat *fs,
+		RNMJOB *job);
+static int rename_dispatch(RENOP *opt, RNMJOB *job);
+static int rename_executing_job(RENOP *opt, RNMJOB *job);
+static int rename_unchanged(RENOP *opt, char *oldname, int attr);
+static int rename_transform(RENOP *opt, char *fname, char *oldbase);
+static int rename_executing(RENOP *opt, RNMJOB *job);
+static int rename_attrib(RENOP *opt, RNMJOB *job, char *fname);
+static int rename_attr_changed(RENOP *opt, uid_t uid, gid_t gid, 
+		mode_t mode);
+static mode_t rename_newmode(RENOP *opt, mode_t mode);
+static int rename_conflict(RENOP *opt, RNMJOB *job, char *fname);
+static void rename_error(RENOP *opt, char *path);
+static int report(RENOP *opt, RNMJOB *job, char *dest, char *sour, 
+		int state);
+static char *report_column(char *col, char *name);
+static void report_dir(RENOP *opt, char *what, char *path);
+static char *report_path(RENOP *opt, RNMDIR *dir, char *name);
 
 
 
 int rename_enfile(RENOP *opt, char *filename)
 {
 	FILE	*fp;
-	char	buf[SVRBUF];
+	char	*buf = NULL;
+	size_t	size = 0;
+	ssize_t	len;
 	int	rc = RNM_ERR_NONE;
 
 	if ((fp = fopen(filename, "r")) == NULL) {
 		return RNM_ERR_OPENFILE;
 	}
-	while (fgets(buf, sizeof(buf), fp) != NULL) {
-		buf[strlen(buf)-1] = 0;
-		rc = rename_entry(opt, buf);
+	while ((len = getline(&buf, &size, fp)) > 0) {
+		if (buf[len - 1] == '\n') {
+			buf[len - 1] = 0;
+		}
+		rc = rename_entry(opt, AT_FDCWD, buf);
 		if (rc != RNM_ERR_NONE) {
 			break;
 		}
 	}
+	free(buf);
 	fclose(fp);
 	return rc;
 }
 
-int rename_entry(RENOP *opt, char *filename)
+/* rename the file, and its contents with -R. The 'filename' is relative
+   to the directory 'dfd', which may be AT_FDCWD */
+int rename_entry(RENOP *opt, int dfd, char *filename)
 {
 	struct	stat	fs;
-	int	rc;
+	char	*fname;
+	int	rc, filter, stated = 0;
+
+	if ((fname = strrchr(filename, '/')) == NULL) {
+		fname = filename;
+	} else {
+		fname++;
+	}
+	opt->stats.entries++;
+	if ((filter = rename_filtering(opt, fname)) < 0) {
+		return RNM_ERR_NONE;
+	}
+	if ((opt->dir == NULL) || (opt->topdir.fd != dfd)) {
+		if ((rc = rename_topdir(opt, dfd, NULL)) != RNM_ERR_NONE) {
+			return rc;
+		}
+	}
 
-	if (opt->cflags & RNM_CFLAG_RECUR)  {
-		if (lstat(filename, &fs) < 0)  {
+	if ((opt->cflags & RNM_CFLAG_RECUR) && !(filter & RNM_FILTER_NODIVE)) {
+		if (walk_lstat(opt, dfd, filename, &fs) < 0)  {
 			return RNM_ERR_STAT;
 		}
-		if (S_ISDIR(fs.st_mode))  {
+		stated = 1;
+		/* the callers below the top, like --watch, set the device of
+		 * their starting point, and a mount point is not descended */
+		if (opt->depth == 0) {
+			opt->xdev = fs.st_dev;
+		}
+		if (S_ISDIR(fs.st_mode) && (!(opt->cflags & RNM_CFLAG_XDEV) ||
+					(fs.st_dev == opt->xdev)))  {
 			rc = rename_recursive(opt, filename);
 			if (rc != RNM_ERR_NONE) {
-				return rc;	//FIXME: return to entry dir
+				return rc;
 			}
 		}
+	} else if ((opt->rule->oflags & RNM_OFLAG_MASKATTR) && 
+			!walk_lstat(opt, dfd, filename, &fs)) {
+		stated = 1;
 	}
-	return rename_action(opt, filename);
+	if (filter & RNM_FILTER_NOACT) {
+		return RNM_ERR_NONE;
+	}
+	return rename_action(opt, filename, stated ? &fs : NULL);
 }
 
-static int rename_recursive(RENOP *opt, char *path)
+/* switch the names to the directory 'dfd', after the jobs of the last one
+   are done. The 'path' of the directory is only for --output, and it's
+   kept by the caller; NULL means the names are relative to the cwd */
+int rename_topdir(RENOP *opt, int dfd, char *path)
 {
-	DIR 	*dir;
 	struct	stat	fs;
-	struct	dirent	*de;
 	int	rc;
 
+	if (opt->dir && ((rc = rename_sched_wait(opt, &opt->topdir))
+				!= RNM_ERR_NONE)) {
+		return rc;
+	}
+	memset(&opt->topdir, 0, sizeof(RNMDIR));
+	opt->topdir.fd = dfd;
+	opt->topdir.path = path;
+	if (opt->sched && !fstatat(dfd, ".", &fs, 0)) {
+		opt->topdir.dev = fs.st_dev;
+	}
+	opt->dir = &opt->topdir;
+	return RNM_ERR_NONE;
+}
+
+/* wait for the jobs of the command line names. It returns the first error
+   of those jobs */
+int rename_finish(RENOP *opt)
+{
+	if (opt->dir == NULL) {
+		return RNM_ERR_NONE;
+	}
+	return rename_sched_wait(opt, &opt->topdir);
+}
+
+/* evaluate the filters and the depth limits on the file name, so nothing
+   else would be done for the excluded files. It returns -1 if the file was
+   excluded, or a combination of RNM_FILTER_NOACT and RNM_FILTER_NODIVE. */
+static int rename_filtering(RENOP *opt, char *fname)
+{
+	int	rc = 0;
+
+	if (opt->depth < opt->rule->mindepth) {
+		rc |= RNM_FILTER_NOACT;
+	}
+	if ((opt->rule->maxdepth >= 0) && (opt->depth >= opt->rule->maxdepth)) {
+		rc |= RNM_FILTER_NODIVE;
+	}
+	if (opt->rule->filter == NULL) {
+		return rc;
+	}
+	if (rename_filter_match(opt->rule, RNM_FILTER_EXCLUDE, fname)) {
+		return -1;
+	}
+	if (rename_filter_match(opt->rule, RNM_FILTER_PRUNE, fname)) {
+		rc |= RNM_FILTER_NODIVE;
+	}
+	if (rename_filter_count(opt->rule, RNM_FILTER_INCLUDE) && 
+			!rename_filter_match(opt->rule, RNM_FILTER_INCLUDE, fname)) {
+		rc |= RNM_FILTER_NOACT;
+	}
+	return rc;
+}
+
+static int rename_recursive(RENOP *opt, char *path)
+{
+	DIR 	*dir = NULL;
+	RNMDIR	sub, *parent = opt->dir;
+	struct	stat	fs;
+	RNMMARK	mark;
+	WALKENT	*plan = NULL, *ent;
+	const	char	*cached = NULL, *p;
+	char	*subs, *name;
+	int	rc, filter, stated, isdir, nsub = 0, sublen;
+
 	if (opt->cflags & RNM_CFLAG_VERBOSE) { 
-		printf("Entering directory [%s]\n", path);
+		report_dir(opt, "Entering", path);
 	}
-	if (chdir(path) < 0)  {
-		perror(path);
+	/* the directory is opened relative to its parent rather than by
+	 * chdir(), so the workers could rename files of many directories */
+	rename_bucket_take(&opt->dir_tb);
+	memset(&sub, 0, sizeof(sub));
+	sub.fd = openat(parent->fd, path, 
+			O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (sub.fd < 0)  {
+		rename_error(opt, path);
 		return RNM_ERR_CHDIR;
 	}
-	if ((dir = opendir(".")) == NULL)  {
-		perror("opendir");
+	/* a directory done by the last run and not changed since is not
+	 * read at all, only its subdirectories are visited */
+	if ((opt->sched || opt->dircache) && !fstat(sub.fd, &fs)) {
+		sub.dev = fs.st_dev;
+		if (opt->dircache) {
+			cached = rename_dircache_lookup(opt, &fs, &nsub);
+		}
+	}
+	if (cached) {
+		opt->stats.dc_hit++;
+	} else if ((dir = fdopendir(sub.fd)) == NULL)  {
+		rename_error(opt, path);
+		close(sub.fd);
 		return RNM_ERR_OPENDIR;
+	} else {
+		opt->stats.dirs++;
+	}
+	/* whatever the directory takes is in the arena above the mark, and
+	 * dropped at once when it's left */
+	rename_arena_mark(&opt->arena, &mark);
+	if ((opt->outfmt != RNM_OUT_TEXT) && 
+			((sub.path = report_path(opt, parent, path)) == NULL)) {
+		dir ? closedir(dir) : close(sub.fd);
+		return RNM_ERR_LOWMEM;
 	}
+	opt->dir = &sub;
+	opt->depth++;
+	RNM_PROBE2(dir__enter, path, opt->depth);
 
 	rc = RNM_ERR_NONE;
-	while ((de = readdir(dir)) != NULL)  {
-		if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) {
+	for (p = cached; p && nsub--; p += strlen(p) + 1) {
+		if ((rc = rename_recursive(opt, (char *) p)) != RNM_ERR_NONE) {
+			break;
+		}
+	}
+
+	/* the directory is read to the end before any of its entries is
+	 * renamed, or readdir() could meet a renamed entry again by its new
+	 * name */
+	if (dir && ((rc = walk_plan(opt, dir, &plan)) != RNM_ERR_NONE)) {
+		plan = NULL;
+	}
+	for (ent = plan; ent; ent = ent->next) {
+		name = ent->name;
+		opt->stats.entries++;
+		if ((filter = rename_filtering(opt, name)) < 0) {
 			continue;
 		}
-		if (lstat(de->d_name, &fs) < 0) {
+		stated = isdir = 0;
+		if (opt->rule->oflags & RNM_OFLAG_MASKATTR) {
+			/* the attributes are compared with this stat later
+			 * so the workers need not stat the file again */
+			if (walk_lstat(opt, sub.fd, name, &fs) < 0) {
+				sub.failed++;
+				continue;
+			}
+			stated = 1;
+			isdir = S_ISDIR(fs.st_mode);
+		} else if (filter & RNM_FILTER_NODIVE) {
+			;		/* no need to know its type */
+		} else
+#ifdef	_DIRENT_HAVE_D_TYPE
+		/* most file systems tell the type of the entry already so
+		 * the lstat() is only required for unknown types */
+		if (ent->type != DT_UNKNOWN) {
+			isdir = (ent->type == DT_DIR);
+		} else 
+#endif
+		if (walk_lstat(opt, sub.fd, name, &fs) < 0) {
+			sub.failed++;
 			continue; 	/* maybe permission denied */
+		} else {
+			stated = 1;
+			isdir = S_ISDIR(fs.st_mode);
+		}
+		if (filter & RNM_FILTER_NODIVE) {
+			isdir = 0;
+		}
+
+		/* the mount point is renamed but never descended */
+		if (isdir && (opt->cflags & RNM_CFLAG_XDEV)) {
+			if (!stated && (walk_lstat(opt, sub.fd, name, 
+							&fs) < 0)) {
+				sub.failed++;
+				continue;
+			}
+			stated = 1;
+			if (fs.st_dev != opt->xdev) {
+				isdir = 0;
+			}
 		}
 	
-		if (S_ISDIR(fs.st_mode)) {
-			rc = rename_recursive(opt, de->d_name);
+		if (isdir) {
+			ent->descended = 1;
+			rc = rename_recursive(opt, name);
 			if (rc != RNM_ERR_NONE) {
 				break;
 			}
 		}
-		rc = rename_action(opt, de->d_name);
+		if (filter & RNM_FILTER_NOACT) {
+			continue;
+		}
+		rc = rename_action(opt, name, stated ? &fs : NULL);
 		if (rc != RNM_ERR_NONE) {
 			break;
 		}
+		if (opt->sched && 
+				(rc = rename_sched_error(opt, &sub)) != RNM_ERR_NONE) {
+			break;
+		}
 	}
-	closedir(dir);
-    
-	if (chdir("..") < 0) {
-		perror("..");
-		return RNM_ERR_CHDIR;
+
+	/* all files must be done before the directory itself is renamed */
+	filter = rename_sched_wait(opt, &sub);
+	if (rc == RNM_ERR_NONE) {
+		rc = filter;
+	}
+	RNM_PROBE2(dir__leave, path, rc);
+	opt->depth--;
+	opt->dir = parent;
+	if (dir && opt->dircache && (rc == RNM_ERR_NONE) && !sub.failed &&
+			!fstat(sub.fd, &fs) && (subs = walk_subdirs(opt, plan,
+					&sublen, &nsub)) != NULL) {
+		rename_dircache_store(opt, &fs, subs, sublen, nsub);
 	}
+	dir ? closedir(dir) : close(sub.fd);
+	rename_arena_release(&opt->arena, &mark);
+    
 	if (opt->cflags & RNM_CFLAG_VERBOSE) {
-		printf("Leaving directory [%s]\n", path);
+		report_dir(opt, "Leaving", path);
 	}
 	return rc;
 }
 
-static int rename_action(RENOP *opt, char *oldname)
+/* the lstat() of the walk, relative to the directory fd */
+static int walk_lstat(RENOP *opt, int dfd, char *name, struct stat *fs)
 {
-	char	*fname;
-	int	rc = RNM_ERR_NONE, flen, renamed = 0;
+	unsigned long long	t;
+	int	rc;
+
+	opt->stats.stats++;
+	t = rename_lat_start(&opt->stats);
+	rc = fstatat(dfd, name, fs, AT_SYMLINK_NOFOLLOW);
+	rename_lat_stop(&opt->stats, RNM_LAT_STAT, t);
+	return rc;
+}
+
+static struct dirent *walk_readdir(RENOP *opt, DIR *dir)
+{
+	struct	dirent	*de;
+	unsigned long long	t;
+
+	t = rename_lat_start(&opt->stats);
+	de = readdir(dir);
+	rename_lat_stop(&opt->stats, RNM_LAT_READDIR, t);
+	return de;
+}
+
+/* read the whole directory into the plan, in the order of readdir() */
+static int walk_plan(RENOP *opt, DIR *dir, WALKENT **plan)
+{
+	struct	dirent	*de;
+	WALKENT	*ent, **tail = plan;
+	int	n;
+
+	while ((de = walk_readdir(opt, dir)) != NULL)  {
+		if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) {
+			continue;
+		}
+		n = strlen(de->d_name);
+		ent = rename_arena_alloc(&opt->arena, sizeof(WALKENT) + n);
+		if (ent == NULL) {
+			return RNM_ERR_LOWMEM;
+		}
+		ent->next = NULL;
+#ifdef	_DIRENT_HAVE_D_TYPE
+		ent->type = de->d_type;
+#else
+		ent->type = 0;		/* DT_UNKNOWN */
+#endif
+		ent->descended = 0;
+		memcpy(ent->name, de->d_name, n + 1);
+		*tail = ent;
+		tail  = &ent->next;
+	}
+	return RNM_ERR_NONE;
+}
+
+/* the names of the subdirectories visited, back to back for the directory
+   cache. An empty list is not NULL */
+static char *walk_subdirs(RENOP *opt, WALKENT *plan, int *len, int *nsub)
+{
+	WALKENT	*ent;
+	char	*subs, *p;
+
+	*len = *nsub = 0;
+	for (ent = plan; ent; ent = ent->next) {
+		if (ent->descended) {
+			*len += strlen(ent->name) + 1;
+			(*nsub)++;
+		}
+	}
+	if ((subs = rename_arena_alloc(&opt->arena, *len + 1)) == NULL) {
+		return NULL;
+	}
+	for (ent = plan, p = subs; ent; ent = ent->next) {
+		if (ent->descended) {
+			strcpy(p, ent->name);
+			p += strlen(p) + 1;
+		}
+	}
+	return subs;
+}
+
+/* grow the name buffer to 'size' bytes at least */
+static int rename_buffer(RENOP *opt, int size)
+{
+	char	*p;
+	int	n;
+
+	for (n = opt->bufsize ? opt->bufsize : 256; n < size; n *= 2);
+	if ((p = realloc(opt->buffer, n)) == NULL) {
+		return RNM_ERR_LOWMEM;
+	}
+	opt->buffer  = p;
+	opt->bufsize = n;
+	return RNM_ERR_NONE;
+}
+
+/* the stat() of the jobs, relative to the directory fd of the job */
+static int job_stat(RNMJOB *job, char *name, struct stat *fs, int flags)
+{
+	unsigned long long	t;
+	int	rc;
+
+	job->stats->stats++;
+	t = rename_lat_start(job->stats);
+	rc = fstatat(job->dir->fd, name, fs, flags);
+	rename_lat_stop(job->stats, RNM_LAT_STAT, t);
+	return rc;
+}
+
+/* rename the file, or change its attributes, or both. The 'fs' is the
+   lstat() of the file by the walk, or NULL if it was not stat */
+static int rename_action(RENOP *opt, char *oldname, struct stat *fs)
+{
+	RNMJOB	job;
+	double	start = 0;
+	int	rc;
+
+	if (opt->cflags & RNM_CFLAG_STATS) {
+		start = rename_stats_clock();
+	}
+	RNM_PROBE1(match__start, oldname);
+	rc = rename_matching(opt, oldname, fs, &job);
+	RNM_PROBE2(match__end, oldname, rc);
+	if (opt->cflags & RNM_CFLAG_STATS) {
+		opt->stats.match += rename_stats_clock() - start;
+	}
+	if (rc <= 0) {
+		return rc;	/* nothing to do, or an error */
+	}
 
-	if (safe_copy(opt->buffer, oldname, FNBUF) < 0) {
-		return RNM_ERR_OVERFLOW;
+	job.stats = &opt->stats;
+	if (opt->sched == NULL) {
+		return rename_job(opt, &job);
 	}
-	opt->room = FNBUF - strlen(opt->buffer) - 1;
+	return rename_dispatch(opt, &job);
+}
+
+/* match and transform the name into the job. It returns 1 if the job was
+   made, 0 if nothing to do with the file, or an error */
+static int rename_matching(RENOP *opt, char *oldname, struct stat *fs,
+		RNMJOB *job)
+{
+	char	*fname;
+	int	rc = RNM_ERR_NONE, attr, len, base, size;
 
+	attr = opt->rule->oflags & RNM_OFLAG_MASKATTR;
+	if (attr && fs && !rename_attr_changed(opt, fs->st_uid, fs->st_gid,
+				fs->st_mode)) {
+		attr = 0;	/* the attributes are right already */
+	}
+	if (rename_unchanged(opt, oldname, attr)) {
+		return RNM_ERR_NONE;
+	}
 	/* indicate the expected filename, not the whole path */
-	if ((fname = strrchr(opt->buffer, '/')) == NULL) {
-		fname = opt->buffer;
+	if ((fname = strrchr(oldname, '/')) == NULL) {
+		fname = oldname;
 	} else {
 		fname++;
 	}
-	
 	if (!strcmp(fname, ".") || !strcmp(fname, "..")) {
 		return RNM_ERR_NONE;
 	}
-    
-	flen = strlen(fname);
-	switch (opt->action)  {
-	case RNM_ACT_FORWARD:
-		rc = match_forward(opt, fname, flen);
-		break;
-	case RNM_ACT_BACKWARD:
-		rc = match_backward(opt, fname, flen);
-		break;
-	case RNM_ACT_REGEX:
-		rc = match_regexpr(opt, fname, flen);
-		break;
-	case RNM_ACT_SUFFIX:
-		rc = match_suffix(opt, fname, flen);
-		break;
+
+	/* the buffer is doubled until the new name fits, with the room of
+	 * 'dest/sour' in case the dest is a directory */
+	len  = strlen(oldname);
+	base = fname - oldname;
+	for (size = len * 2 + 2; ; size = opt->bufsize * 2) {
+		if ((opt->bufsize < size) && 
+				((rc = rename_buffer(opt, size)) != RNM_ERR_NONE)) {
+			return rc;
+		}
+		memcpy(opt->buffer, oldname, len + 1);
+		opt->room = opt->bufsize - len - 1;
+		rc = rename_transform(opt, opt->buffer + base, oldname + base);
+		if ((rc == RNM_CACHE_NEW) && (opt->room < len + 2)) {
+			rc = RNM_ERR_LONGPATH;
+		}
+		if (rc != RNM_ERR_LONGPATH) {
+			break;
+		}
 	}
 	if (rc < 0) {
-		return RNM_ERR_LONGPATH;
+		return rc;
 	}
-	if (opt->action && !strcmp(opt->buffer, oldname)) {
+	if (rc == RNM_CACHE_NOMATCH) {
 		return RNM_ERR_NONE;
 	}
-	
-	if ((opt->oflags & RNM_OFLAG_MASKCASE) == RNM_OFLAG_LOWERCASE) {
-		match_lowercase((unsigned char *) fname);
-	} else if ((opt->oflags & RNM_OFLAG_MASKCASE) == RNM_OFLAG_UPPERCASE) {
-		match_uppercase((unsigned char *) fname);
+	if ((rc == RNM_CACHE_SAME) && !attr) {
+		return RNM_ERR_NONE;
+	}
+
+	job->dir   = opt->dir;
+	job->dest  = (rc == RNM_CACHE_NEW) ? opt->buffer : NULL;
+	job->sour  = oldname;
+	job->room  = opt->room;
+	job->attr  = attr;
+	job->stated = (fs != NULL);
+	if (fs) {
+		job->st_uid  = fs->st_uid;
+		job->st_gid  = fs->st_gid;
+		job->st_mode = fs->st_mode;
+	}
+	return 1;
+}
+
+/* copy the job so the workers could take it later */
+static int rename_dispatch(RENOP *opt, RNMJOB *job)
+{
+	RNMJOB	*copy;
+	int	dlen, slen, rc, pooled;
+
+	/* most jobs fit in the objects of the pool with their names */
+	slen = strlen(job->sour) + 1;
+	dlen = job->dest ? strlen(job->dest) + slen + 2 : 0;
+	pooled = (sizeof(RNMJOB) + dlen + slen <= RNM_JOB_SIZE);
+	copy = pooled ? rename_pool_get(&opt->jobs) :
+		malloc(sizeof(RNMJOB) + dlen + slen);
+	if (copy == NULL) {
+		return RNM_ERR_LOWMEM;
+	}
+	*copy = *job;
+	copy->pooled = pooled;
+	copy->sour = (char *)(copy + 1);
+	memcpy(copy->sour, job->sour, slen);
+	if (job->dest) {
+		/* leave the room of 'dest/sour' for moving into a directory */
+		copy->dest = copy->sour + slen;
+		strcpy(copy->dest, job->dest);
+		copy->room = slen + 1;
+	}
+	if ((rc = rename_sched_submit(opt, copy)) != RNM_ERR_NONE) {
+		rename_job_free(opt, copy);
+	}
+	return rc;
+}
+
+/* give the job back to where rename_dispatch() took it from */
+void rename_job_free(RENOP *opt, RNMJOB *job)
+{
+	if (job->pooled) {
+		rename_pool_put(&opt->jobs, job);
+	} else {
+		free(job);
+	}
+}
+
+/* rename the file and/or change its attributes. It's called by the workers
+   as well, so it must not touch the name buffer of the 'opt' */
+int rename_job(RENOP *opt, RNMJOB *job)
+{
+	double	start;
+	int	rc;
+
+	if ((opt->cflags & RNM_CFLAG_STATS) == 0) {
+		return rename_executing_job(opt, job);
+	}
+	start = rename_stats_clock();
+	rc = rename_executing_job(opt, job);
+	job->stats->exec += rename_stats_clock() - start;
+	return rc;
+}
+
+static int rename_executing_job(RENOP *opt, RNMJOB *job)
+{
+	char	*fname = job->sour;
+	int	rc = RNM_ERR_NONE, renamed = 0;
+
+	if (opt->outfmt != RNM_OUT_TEXT) {
+		clock_gettime(CLOCK_MONOTONIC, &job->start);
 	}
 
-	if (strcmp(opt->buffer, oldname)) {
-		rc = rename_executing(opt, opt->buffer, oldname);
+	if (job->dest) {
+		rc = rename_executing(opt, job);
 		if (rc == RNM_ERR_SKIP) {
 			rc = RNM_ERR_NONE;
 		} else if (rc == RNM_ERR_NONE) {
 			renamed++;
+			fname = job->dest;
 		} else {
 			return rc;
 		}
 	}
-	if (opt->oflags & RNM_OFLAG_OWNER) {
-		rc = rename_chown(opt, opt->buffer);
+	if (job->attr) {
+		rc = rename_attrib(opt, job, fname);
 		if (rc == RNM_ERR_SKIP) {
 			rc = RNM_ERR_NONE;
 		} else if (rc == RNM_ERR_NONE) {
@@ -248,285 +704,470 @@ static int rename_action(RENOP *opt, char *oldname)
 		}
 	}
 	if (renamed) {
-		opt->rpcnt++;
+		__sync_fetch_and_add(&opt->rpcnt, 1);
 	}
 	return rc;
 }
 
-static int rename_executing(RENOP *opt, char *dest, char *sour)
+/* a quick classifier to tell if the file name could not be changed at all.
+   It works on the original name so nothing is copied. Most files in a tree
+   could be dropped here before the transform pipeline got involved.
+   A regular expression is not tried here; it would be run twice on every
+   name it matches. It returns 1 if the file is surely unchanged, or 0 if
+   unsure. */
+static int rename_unchanged(RENOP *opt, char *oldname, int attr)
+{
+	char	*fname;
+	int	flen;
+
+	if (attr && !opt->rule->action) {
+		return 0;	/* attributes are not decided by the name */
+	}
+	if ((fname = strrchr(oldname, '/')) == NULL) {
+		fname = oldname;
+	} else {
+		fname++;
+	}
+
+	switch (opt->rule->action) {
+	case RNM_ACT_FORWARD:
+	case RNM_ACT_BACKWARD:
+		if (opt->rule->pa_len < 1) {
+			return 1;
+		}
+		if (opt->rule->compare == strncmp) {
+			return strstr(fname, opt->rule->pattern) == NULL;
+		}
+#ifdef	HAVE_STRCASESTR
+		return strcasestr(fname, opt->rule->pattern) == NULL;
+#else
+		return 0;
+#endif
+	case RNM_ACT_SUFFIX:
+		if (opt->rule->pa_len < 1) {
+			return 1;
+		}
+		if ((flen = strlen(fname)) < opt->rule->pa_len) {
+			return 1;
+		}
+		return opt->rule->compare(fname + flen - opt->rule->pa_len, 
+				opt->rule->pattern, opt->rule->pa_len) != 0;
+	case RNM_ACT_REGEX:
+		return 0;
+	}
+
+	/* no pattern so only the case and normalization options could
+	 * change the name */
+	flen = strlen(fname);
+	if ((opt->rule->oflags & RNM_OFLAG_MASKCASE) == RNM_OFLAG_LOWERCASE) {
+		if (rename_case_check(fname, flen, 0)) {
+			return 0;
+		}
+	} else if ((opt->rule->oflags & RNM_OFLAG_MASKCASE) == RNM_OFLAG_UPPERCASE) {
+		if (rename_case_check(fname, flen, 1)) {
+			return 0;
+		}
+	}
+	if (opt->rule->oflags & RNM_OFLAG_MASKNORM) {
+		if (!rename_norm_check(fname, flen, 
+					opt->rule->oflags & RNM_OFLAG_NFD)) {
+			return 0;
+		}
+	}
+	return (opt->rule->oflags & (RNM_OFLAG_MASKCASE | RNM_OFLAG_MASKNORM)) != 0;
+}
+
+/* transform the basename 'fname' inside the name buffer by the pattern and
+   the case options. The 'oldbase' is the original basename. The result is
+   memorized in the name cache because the same basenames tend to appear
+   again and again in a directory tree.
+   It returns RNM_CACHE_NOMATCH if the pattern was not found, RNM_CACHE_SAME
+   if the name was not changed or RNM_CACHE_NEW with the new name in 'fname'.
+*/
+static int rename_transform(RENOP *opt, char *fname, char *oldbase)
+{
+	const char	*newname;
+	int	rc = 0, n, flen, state;
+
+	flen = strlen(fname);
+	if (opt->cache) {
+		state = rename_cache_lookup(opt, oldbase, flen, &newname);
+		if (state == RNM_CACHE_NEW) {
+			if (safe_copy(fname, newname, opt->room + flen + 1) < 0) {
+				return RNM_ERR_LONGPATH;
+			}
+			opt->room -= (int) strlen(fname) - flen;
+			return state;
+		} else if (state != RNM_CACHE_MISS) {
+			return state;
+		}
+	}
+
+	switch (opt->rule->action)  {
+	case RNM_ACT_FORWARD:
+		rc = match_forward(opt->rule, fname, flen, &opt->room);
+		break;
+	case RNM_ACT_BACKWARD:
+		rc = match_backward(opt->rule, fname, flen, &opt->room);
+		break;
+	case RNM_ACT_REGEX:
+		rc = match_regexpr(opt->rule, fname, flen, &opt->room);
+		break;
+	case RNM_ACT_SUFFIX:
+		rc = match_suffix(opt->rule, fname, flen, &opt->room);
+		break;
+	}
+	if (rc < 0) {
+		return RNM_ERR_LONGPATH;
+	}
+
+	if (opt->rule->action && !strcmp(fname, oldbase)) {
+		state = RNM_CACHE_NOMATCH;
+	} else {
+		if ((opt->rule->oflags & RNM_OFLAG_MASKCASE) == RNM_OFLAG_LOWERCASE) {
+			rc = rename_lowercase(fname, strlen(fname), 
+					&opt->room);
+		} else if ((opt->rule->oflags & RNM_OFLAG_MASKCASE) == 
+				RNM_OFLAG_UPPERCASE) {
+			rc = rename_uppercase(fname, strlen(fname),
+					&opt->room);
+		}
+		if (rc < 0) {
+			return RNM_ERR_LONGPATH;
+		}
+		if ((opt->rule->oflags & RNM_OFLAG_MASKNORM) && !rename_norm_check(
+				fname, strlen(fname), opt->rule->oflags & RNM_OFLAG_NFD)) {
+			n = rename_normalize(fname, strlen(fname), 
+					opt->rule->oflags & RNM_OFLAG_NFD, &opt->room);
+			if (n == -2) {
+				return RNM_ERR_LOWMEM;
+			} else if (n < 0) {
+				return RNM_ERR_LONGPATH;
+			}
+			rc += n;
+		}
+		if (opt->rule->action) {
+			state = strcmp(fname, oldbase) ? 
+				RNM_CACHE_NEW : RNM_CACHE_SAME;
+		} else {	/* only the case conversion changed anything */
+			state = rc ? RNM_CACHE_NEW : RNM_CACHE_SAME;
+		}
+	}
+
+	if (opt->cache) {
+		rename_cache_store(opt, oldbase, flen, fname, state);
+	}
+	return state;
+}
+
+static int rename_executing(RENOP *opt, RNMJOB *job)
 {
 	struct	stat	fs;
+	char	*dest = job->dest, *sour = job->sour;
+	int	dfd = job->dir->fd, rc;
+	unsigned long long	t;
 
-	if (!stat(dest, &fs) && S_ISDIR(fs.st_mode))  {
+	if (!job_stat(job, dest, &fs, 0) && S_ISDIR(fs.st_mode))  {
 		/* the destination is directory, which means we must move the
 		 * original file into this directory, just like mv(1) does */
-		if (strlen(sour) + 2 > opt->room) {
+		if (strlen(sour) + 2 > job->room) {
 			return RNM_ERR_LONGPATH;
 		}
 		strcat(dest, "/");
 		strcat(dest, sour);
 	}
-	if (!stat(dest, &fs)) {	/* the target file has existed already */
+	if (!job_stat(job, dest, &fs, 0)) {	/* the target file has existed */
 		switch (opt->cflags & RNM_CFLAG_PROMPT_MASK) {
 		case RNM_CFLAG_NEVER:
-			report(dest, sour, RNM_REP_SKIP, opt->cflags);
+			report(opt, job, dest, sour, RNM_REP_SKIP);
 			return RNM_ERR_SKIP;
 		case RNM_CFLAG_ALWAYS:
 			break;
 		default:
-			if (rename_prompt(opt, dest) == 0) {
-				report(dest, sour, RNM_REP_SKIP, opt->cflags);
+			if (rename_conflict(opt, job, dest) == 0) {
+				report(opt, job, dest, sour, RNM_REP_SKIP);
 				return RNM_ERR_SKIP;
 			}
 			break;
 		}
 	}
 	if (opt->cflags & RNM_CFLAG_TEST) {
-		report(dest, sour, RNM_REP_TEST, opt->cflags);
+		report(opt, job, dest, sour, RNM_REP_TEST);
 		return RNM_ERR_SKIP;
 	}
-	if (rename(sour, dest) < 0) {
-		report(dest, sour, RNM_REP_FAILED, opt->cflags);
+	rename_bucket_take(&opt->ops_tb);
+#ifdef	RENAME_NOREPLACE
+	/* another worker could create the target since it was checked */
+	if ((opt->cflags & RNM_CFLAG_PROMPT_MASK) == RNM_CFLAG_NEVER) {
+		RNM_PROBE3(rename__start, dfd, sour, dest);
+		t = rename_lat_start(job->stats);
+		rc = renameat2(dfd, sour, dfd, dest, RENAME_NOREPLACE);
+		rename_lat_stop(job->stats, RNM_LAT_RENAME, t);
+		RNM_PROBE3(rename__done, dfd, dest, rc ? errno : 0);
+		if (rc == 0) {
+			report(opt, job, dest, sour, RNM_REP_OK);
+			return RNM_ERR_NONE;
+		}
+		if (errno == EEXIST) {
+			report(opt, job, dest, sour, RNM_REP_SKIP);
+			return RNM_ERR_SKIP;
+		}
+		if ((errno != EINVAL) && (errno != ENOSYS)) {
+			report(opt, job, dest, sour, RNM_REP_FAILED);
+			return RNM_ERR_RENAME;
+		}
+		/* not supported by the file system */
+	}
+#endif
+	RNM_PROBE3(rename__start, dfd, sour, dest);
+	t = rename_lat_start(job->stats);
+	rc = renameat(dfd, sour, dfd, dest);
+	rename_lat_stop(job->stats, RNM_LAT_RENAME, t);
+	RNM_PROBE3(rename__done, dfd, dest, rc ? errno : 0);
+	if (rc < 0) {
+		report(opt, job, dest, sour, RNM_REP_FAILED);
 		return RNM_ERR_RENAME;
 	}
-	report(dest, sour, RNM_REP_OK, opt->cflags);
+	report(opt, job, dest, sour, RNM_REP_OK);
 	return RNM_ERR_NONE;
 }
 
-static int rename_chown(RENOP *opt, char *fname)
+/* the symbolic links are changed themselves, not what they point to, so
+   the ownership never escapes the tree; their permission is not used so
+   it's left alone. A renamed file is still the same inode, so the stat of
+   the walk is good for the new name as well */
+static int rename_attrib(RENOP *opt, RNMJOB *job, char *fname)
 {
 	struct	stat	fs;
+	uid_t	uid;
+	gid_t	gid;
+	mode_t	mode;
+	int	newown, newmod, rc;
+	unsigned long long	t;
 
-	if (stat(fname, &fs)) {
-		return RNM_ERR_SKIP;	//FIXME: file not exist
+	if (!job->stated) {
+		if (job_stat(job, fname, &fs, AT_SYMLINK_NOFOLLOW)) {
+			return RNM_ERR_SKIP;	//FIXME: file not exist
+		}
+		job->st_uid  = fs.st_uid;
+		job->st_gid  = fs.st_gid;
+		job->st_mode = fs.st_mode;
 	}
-	if ((fs.st_uid == opt->pw_uid) && (fs.st_gid == opt->pw_gid)) {
+
+	uid = (opt->rule->oflags & RNM_OFLAG_OWNER) ? opt->rule->pw_uid : job->st_uid;
+	gid = (opt->rule->oflags & RNM_OFLAG_GROUP) ? opt->rule->pw_gid : job->st_gid;
+	newown = (uid != job->st_uid) || (gid != job->st_gid);
+	mode = job->st_mode & 07777;
+	if ((opt->rule->oflags & RNM_OFLAG_MODE) && !S_ISLNK(job->st_mode)) {
+		mode = rename_newmode(opt, job->st_mode);
+	}
+	newmod = (mode != (job->st_mode & 07777));
+	if (!newown && !newmod) {
 		return RNM_ERR_SKIP;
 	}
 	if (opt->cflags & RNM_CFLAG_TEST) {
-		report(fname, fname, RNM_REP_TEST, opt->cflags);
+		report(opt, job, fname, fname, RNM_REP_TEST);
 		return RNM_ERR_SKIP;
 	}
-	if (chown(fname, opt->pw_uid, opt->pw_gid) < 0) {
-		report(fname, fname, RNM_REP_FAILED, opt->cflags);
-		return RNM_ERR_CHOWN;
+	rename_bucket_take(&opt->ops_tb);
+	/* chown() may clear the set-user-ID bits so chmod() goes after */
+	if (newown) {
+		RNM_PROBE4(chown__start, job->dir->fd, fname, uid, gid);
+		t = rename_lat_start(job->stats);
+		rc = fchownat(job->dir->fd, fname, 
+				(opt->rule->oflags & RNM_OFLAG_OWNER) ? uid : -1,
+				(opt->rule->oflags & RNM_OFLAG_GROUP) ? gid : -1,
+				AT_SYMLINK_NOFOLLOW);
+		rename_lat_stop(job->stats, RNM_LAT_CHOWN, t);
+		RNM_PROBE3(chown__done, job->dir->fd, fname, rc ? errno : 0);
+		if (rc < 0) {
+			report(opt, job, fname, fname, RNM_REP_FAILED);
+			return RNM_ERR_CHOWN;
+		}
+	}
+	if (newmod) {
+		t = rename_lat_start(job->stats);
+		rc = fchmodat(job->dir->fd, fname, mode, 0);
+		rename_lat_stop(job->stats, RNM_LAT_CHMOD, t);
+		if (rc < 0) {
+			report(opt, job, fname, fname, RNM_REP_FAILED);
+			return RNM_ERR_CHMOD;
+		}
 	}
-	report(fname, fname, RNM_REP_CHOWN, opt->cflags);
+	report(opt, job, fname, fname, newown ? RNM_REP_CHOWN : RNM_REP_CHMOD);
 	return RNM_ERR_NONE; 
 }
 
-static int rename_prompt(RENOP *opt, char *fname)
+/* return non-zero if the ownership or the permission of the file would be
+   changed by -o, --group or --mode */
+static int rename_attr_changed(RENOP *opt, uid_t uid, gid_t gid, mode_t mode)
 {
-	char	buf[64];
-
-	fprintf(stderr, "Overwrite '%s'?  (Yes/No/Always/Skip) ", fname);
-	tcflush(0, TCIFLUSH);
-	if (read(0, buf, 64) <= 0) {
-		return 0;
+	if ((opt->rule->oflags & RNM_OFLAG_OWNER) && (uid != opt->rule->pw_uid)) {
+		return 1;
 	}
-
-	switch (*(skip_space(buf)))  {
-	case 'a':
-	case 'A':
-		opt->cflags &= ~RNM_CFLAG_PROMPT_MASK;
-		opt->cflags |= RNM_CFLAG_ALWAYS;
+	if ((opt->rule->oflags & RNM_OFLAG_GROUP) && (gid != opt->rule->pw_gid)) {
 		return 1;
-	case 's':
-	case 'S':
-		opt->cflags &= ~RNM_CFLAG_PROMPT_MASK;
-		opt->cflags |= RNM_CFLAG_NEVER;
-		return 0;
-	case 'y':
-	case 'Y':
+	}
+	if ((opt->rule->oflags & RNM_OFLAG_MODE) && !S_ISLNK(mode) &&
+			(rename_newmode(opt, mode) != (mode & 07777))) {
 		return 1;
-	case 'n':
-	case 'N':
-		return 0;
 	}
 	return 0;
 }
 
+/* apply the clauses of --mode to the file mode, like chmod(1) does */
+static mode_t rename_newmode(RENOP *opt, mode_t mode)
+{
+	const	RNMMODE	*md;
+	mode_t	newmode = mode & 07777, perm;
+	int	i;
 
-/* to match a null-terminated string against the precompiled pattern buffer.
-   When successed, it substitutes matches with the second parameter so
-   the original string with enough buffer will be modified.
-   Note: precompiled pattern buffer be set to globel.
-   If no matches in the string, return 0.
-*/
-static int match_regexpr(RENOP *opt, char *fname, int flen)
-{
-	regmatch_t	pmatch[1];
-	int		count = 0;
-
-	while (!regexec(opt->preg, fname, 1, pmatch, 0))  {
-		opt->room = inject(fname + pmatch->rm_so, flen - pmatch->rm_so,
-				pmatch->rm_eo - pmatch->rm_so, opt->room,
-				opt->substit, opt->su_len);
-		if (opt->room < 0) {
-			return opt->room;
-		}
-		fname += pmatch->rm_so + opt->su_len;
-		flen  -= pmatch->rm_so - opt->su_len;
-		count++;
-		
-		if (flen <= 0) {
-			break;
+	for (i = 0, md = opt->rule->mode; i < opt->rule->md_num; i++, md++) {
+		perm = md->perm;
+		if (md->cond_x && (S_ISDIR(mode) || (newmode & 0111))) {
+			perm |= 0111;
 		}
-		if (opt->count && (count >= opt->count)) {
+		perm &= md->mask;
+		switch (md->op) {
+		case '+':
+			newmode |= perm;
+			break;
+		case '-':
+			newmode &= ~perm;
+			break;
+		default:
+			newmode = (newmode & ~md->who) | perm;
 			break;
 		}
 	}
-	return count;
+	return newmode;
 }
 
-static int match_forward(RENOP *opt, char *fname, int flen)
+/* ask the caller what to do with the existing file. Nobody to ask means
+   the file is kept. It returns 1 to overwrite it */
+static int rename_conflict(RENOP *opt, RNMJOB *job, char *fname)
 {
-	int	count = 0;
-
-	if (opt->pa_len < 1) {
+	if (opt->cb.conflict == NULL) {
 		return 0;
 	}
-	while (flen >= opt->pa_len) {
-		if (opt->compare(fname, opt->pattern, opt->pa_len)) {
-			fname++;
-			flen--;
-			continue;
-		}
-
-		opt->room = inject(fname, flen, opt->pa_len, opt->room,
-				opt->substit, opt->su_len);
-		if (opt->room < 0) {
-			return opt->room;
-		}
-		count++;
-		flen += opt->su_len - opt->pa_len;
-
-		if (opt->count && (count >= opt->count)) {
-			break;
-		}
-		fname += opt->su_len;
-		flen  -= opt->su_len;
+	rename_output_flush(opt);	/* the question follows the reports */
+	switch (opt->cb.conflict(opt->cb.data, job->dir->fd, fname)) {
+	case RNM_ANS_ALWAYS:
+		opt->cflags &= ~RNM_CFLAG_PROMPT_MASK;
+		opt->cflags |= RNM_CFLAG_ALWAYS;
+		return 1;
+	case RNM_ANS_NEVER:
+		opt->cflags &= ~RNM_CFLAG_PROMPT_MASK;
+		opt->cflags |= RNM_CFLAG_NEVER;
+		return 0;
+	case RNM_ANS_YES:
+		return 1;
 	}
-	return count;
+	return 0;
 }
 
-static int match_backward(RENOP *opt, char *fname, int flen)
+static void rename_error(RENOP *opt, char *path)
 {
-	char	*fidx;
-	int	count = 0;
-
-	if (opt->pa_len < 1) {
-		return 0;
+	if (opt->cb.error) {
+		opt->cb.error(opt->cb.data, path, errno);
 	}
+}
 
-	flen -= opt->pa_len;
-	fidx = fname + flen;
-	while (fidx >= fname) {
-		if (opt->compare(fidx, opt->pattern, opt->pa_len)) {
-			fidx--;
-			flen++;
-			continue;
-		}
 
-		opt->room = inject(fidx, flen, opt->pa_len, 
-				opt->room, opt->substit, opt->su_len);
-		if (opt->room < 0) {
-			return opt->room;
-		}
-		count++;
-		flen += opt->su_len - opt->pa_len;
+/* the names are padded or cut to the columns. The lines are formatted
+   by hand into the output buffer since there may be millions of them */
+static int report(RENOP *opt, RNMJOB *job, char *dest, char *sour, 
+		int state)
+{
+#define LISTWIDTH	32
+	char	line[LISTWIDTH * 2 + 16], *p;
+	int	err = (state == RNM_REP_FAILED) ? errno : 0;
 
-		if (opt->count && (count >= opt->count)) {
-			break;
+	job->stats->state[state]++;
+	/* a name declined by the user is asked again by the next run */
+	if ((state == RNM_REP_FAILED) || ((state == RNM_REP_SKIP) &&
+			((opt->cflags & RNM_CFLAG_PROMPT_MASK) != RNM_CFLAG_NEVER))) {
+		__sync_fetch_and_add(&job->dir->failed, 1);
+	}
+	if (opt->cb.report) {
+		opt->cb.report(opt->cb.data, job->dir->fd, dest, sour, 
+				state, err);
+		if (opt->output == NULL) {
+			return 0;	/* a library context */
 		}
-		fidx -= opt->pa_len;
-		flen += opt->pa_len;
 	}
-	return count;
-}
 
-static int match_suffix(RENOP *opt, char *fname, int flen)
-{
-	if (opt->pa_len < 1) {
+	if (!rename_output_count(opt, state)) {
 		return 0;
 	}
-	if (opt->su_len - opt->pa_len > opt->room) {
-		return -1;	/* oversized */
+	if (opt->outfmt != RNM_OUT_TEXT) {
+		rename_output_record(opt, job, dest, sour, state, err);
+		return 0;
 	}
-	fname += flen - opt->pa_len;
-	if (!opt->compare(fname, opt->pattern, opt->pa_len)) {
-		strcpy(fname, opt->substit);
-		return 1;
+	if ((opt->cflags & RNM_CFLAG_VERBOSE) == 0) {
+		return 0;
 	}
-	return 0;
-}
 
-static int match_lowercase(unsigned char *s)
-{
-	while (*s) {
-		*s = tolower((int) *s);
-		s++;
-	}
+	p = report_column(line, sour);
+	memcpy(p, " -> ", 4);
+	p = report_column(p + 4, dest);
+	memcpy(p, " : ", 3);
+	p += 3;
+	strcpy(p, rep_state[state]);
+	p += strlen(p);
+	*p++ = '\n';
+	rename_output_write(opt, line, p - line);
 	return 0;
 }
 
-static int match_uppercase(unsigned char *s)
+static char *report_column(char *col, char *name)
 {
-	while (*s) {
-		*s = toupper((int) *s);
-		s++;
+	int	len;
+
+	memset(col, ' ', LISTWIDTH - 1);
+	len = strlen(name);
+	if (len < LISTWIDTH) {
+		memcpy(col, name, len);
+	} else {
+		memcpy(col, name + len - LISTWIDTH + 1, LISTWIDTH - 1);
+		col[0] = col[1] = '.';
 	}
-	return 0;
+	return col + LISTWIDTH - 1;
 }
 
-static int inject(char *rec, int rlen, int del, int room, char *in, int ilen)
+/* the full path of the file in the directory for --output */
+static char *report_path(RENOP *opt, RNMDIR *dir, char *name)
 {
-	char	*sour;
-	int	acc;
+	char	*path;
+	int	len, nlen = strlen(name) + 1;
 
-	sour = rec + del;
-	if ((acc = ilen - del) != 0) {
-		if ((room -= acc) < 0) {
-			return room;
+	len = dir->path ? strlen(dir->path) + 1 : 0;
+	if ((path = rename_arena_alloc(&opt->arena, len + nlen)) != NULL) {
+		if (len) {
+			memcpy(path, dir->path, len - 1);
+			path[len - 1] = '/';
 		}
-		memmove(sour + acc, sour, rlen - del + 1);
+		memcpy(path + len, name, nlen);
 	}
-	memcpy(rec, in, ilen);
-	return room;
+	return path;
 }
 
-static int report(char *dest, char *sour, int state, int flag)
+static void report_dir(RENOP *opt, char *what, char *path)
 {
-#define LISTWIDTH	32
-	char	sname[LISTWIDTH], dname[LISTWIDTH];
+	RNMMARK	mark;
+	char	*line;
 	int	len;
 
-	if ((flag & RNM_CFLAG_VERBOSE) == 0) {
-		return 0;
-	}
-
-	memset(dname, ' ', sizeof(dname));
-	len = strlen(dest);
-	if (len < LISTWIDTH) {
-		memcpy(dname, dest, len);
-	} else {
-		memcpy(dname, dest + len - LISTWIDTH + 1, LISTWIDTH - 1);
-		dname[0] = dname[1] = '.';
+	if (!rename_output_count(opt, -1) || (opt->outfmt != RNM_OUT_TEXT)) {
+		return;		/* no per file lines in the progress mode */
 	}
-	dname[LISTWIDTH -1] = 0;
-
-	memset(sname, ' ', sizeof(sname));
-	len = strlen(sour);
-	if (len < LISTWIDTH) {
-		memcpy(sname, sour, len);
-	} else {
-		memcpy(sname, sour + len - LISTWIDTH + 1, LISTWIDTH - 1);
-		sname[0] = sname[1] = '.';
+	rename_arena_mark(&opt->arena, &mark);
+	len = strlen(what) + strlen(path) + 16;
+	if ((line = rename_arena_alloc(&opt->arena, len)) != NULL) {
+		len = sprintf(line, "%s directory [%s]\n", what, path);
+		rename_output_write(opt, line, len);
 	}
-	sname[LISTWIDTH -1] = 0;
-
-	printf("%s -> %s : %s\n", sname, dname, rep_state[state]);
-	return 0;
+	rename_arena_release(&opt->arena, &mark);
 }
 
 int safe_copy(char *dest, const char *src, size_t n)
@@ -21,23 +21,7 @@
 #ifndef	_RENAME_H_
 #define _RENAME_H_
   
-#define RNM_ERR_NONE		0
-#define RNM_ERR_SKIP		1
-#define RNM_ERR_HELP		-1
-#define RNM_ERR_PARAM		-2	/* wrong (command line) parameters */
-#define RNM_ERR_GETDIR		-3	/* can not get directory name */
-#define RNM_ERR_EUID		-4	/* invalid user id */
-#define RNM_ERR_LOWMEM		-5	/* low memory */
-#define RNM_ERR_REGPAT		-6	/* wrong regex pattern */
-#define RNM_ERR_STAT		-7	/* failed to stat of the file */
-#define RNM_ERR_CHDIR		-8
-#define RNM_ERR_OPENDIR		-9
-#define RNM_ERR_LONGPATH	-10	/* path name is too long */
-#define RNM_ERR_OPENFILE	-11
-#define RNM_ERR_OVERFLOW	-12
-#define RNM_ERR_RENAME		-13
-#define RNM_ERR_CHOWN		-14
-
+#include "librenamex.h"
 
 #define RNM_CFLAG_NONE		0
 #define RNM_CFLAG_NEVER		1	/* say no to all existed files */
@@ -46,12 +30,20 @@
 #define RNM_CFLAG_RECUR		0x100	/* recursive operation */
 #define RNM_CFLAG_VERBOSE	0x200	/* verbose mode */
 #define RNM_CFLAG_TEST		0x400	/* test mode only */
+#define RNM_CFLAG_XDEV		0x800	/* stay in the same file system */
+#define RNM_CFLAG_STATS		0x1000	/* time the phases for --stats */
 
 #define	RNM_OFLAG_NONE		0	/* do not change output filename */
 #define RNM_OFLAG_LOWERCASE	1	/* lowercase the output filename */
 #define RNM_OFLAG_UPPERCASE	2	/* uppercase the output filename */
 #define RNM_OFLAG_MASKCASE	3
-#define RNM_OFLAG_OWNER		4	/* change the file's ownership */
+#define RNM_OFLAG_OWNER		4	/* change the file's owner */
+#define RNM_OFLAG_NFC		8	/* normalize the filename to NFC */
+#define RNM_OFLAG_NFD		0x10	/* normalize the filename to NFD */
+#define RNM_OFLAG_MASKNORM	0x18
+#define RNM_OFLAG_GROUP		0x20	/* change the file's group */
+#define RNM_OFLAG_MODE		0x40	/* change the file's permission */
+#define RNM_OFLAG_MASKATTR	0x64
 
 #define RNM_ACT_NONE		0
 #define RNM_ACT_FORWARD		1	/* search and substitute simplely */
@@ -59,22 +51,135 @@
 #define RNM_ACT_REGEX		3	/* enable regular expression */
 #define	RNM_ACT_SUFFIX		6	/* append the suffix */
 
-#define RNM_REP_OK		0
-#define RNM_REP_SKIP		1
-#define RNM_REP_TEST		2
-#define RNM_REP_FAILED		3
-#define RNM_REP_CHOWN		4
+#define RNM_OUT_TEXT		0	/* the formats of --output */
+#define RNM_OUT_JSONL		1
+#define RNM_OUT_TSV		2
+#define RNM_OUT_NUL		3
+
+#define RNM_CACHE_MISS		0
+#define RNM_CACHE_NOMATCH	1	/* pattern not found, skip the file */
+#define RNM_CACHE_SAME		2	/* transformed but not changed */
+#define RNM_CACHE_NEW		3	/* transformed to a new name */
+#define RNM_CACHE_SLOTS		4096	/* default size of the name cache */
+
+#define RNM_IOPRIO_RT		1	/* the I/O scheduling classes */
+#define RNM_IOPRIO_BE		2
+#define RNM_IOPRIO_IDLE		3
+
+#define RNM_FILTER_INCLUDE	0	/* only rename the matching files */
+#define RNM_FILTER_EXCLUDE	1	/* skip the matching files and dirs */
+#define RNM_FILTER_PRUNE	2	/* do not descend matching dirs */
+#define RNM_FILTER_MAX		3
 
-#define	SVRBUF	512
-#define FNBUF	4096
+#define RNM_JOB_SIZE		512	/* the pooled jobs with their names */
+
+struct	_RNMCACHE;
+struct	_RNMFILTER;
+struct	_RNMSCHED;
+
+/* the bump arena of the walk and the slab pool of the jobs, see arena.c */
+typedef	struct	_RNMCHUNK	RNMCHUNK;
 
+typedef	struct	{
+	RNMCHUNK	*chunk;		/* in use, the latest first */
+	RNMCHUNK	*spare;		/* released, for reuse */
+	char	*ptr;
+	char	*end;
+} RNMARENA;
+
+typedef	struct	{
+	RNMCHUNK	*chunk;
+	char	*ptr;
+} RNMMARK;
+
+typedef	struct	{
+	size_t	size;		/* of the objects */
+	void	*local;		/* free objects of the owner thread */
+	void	*shared;	/* put back by the other threads */
+	RNMCHUNK	*slabs;
+} RNMPOOL;
+
+/* token bucket of the operations per second, see sched.c */
+typedef	struct	{
+	double	rate;		/* 0 = unlimited */
+	double	tokens;
+	struct	timespec	last;
+	pthread_mutex_t		*lock;
+} RNMBUCKET;
+
+/* the directory where the names of the renaming jobs are relative to */
+typedef	struct	{
+	int	fd;
+	dev_t	dev;
+	int	pending;	/* jobs queued but not done yet */
+	int	rc;		/* the first error of its jobs */
+	int	failed;		/* entries failed or skipped, see dircache.c */
+	char	*path;		/* only for --output, NULL if the cwd */
+} RNMDIR;
+
+#define RNM_LAT_READDIR		0	/* the system calls timed */
+#define RNM_LAT_STAT		1
+#define RNM_LAT_RENAME		2
+#define RNM_LAT_CHOWN		3
+#define RNM_LAT_CHMOD		4
+#define RNM_LAT_MAX		5
+
+/* the counters of a thread, see stats.c */
+typedef	struct	{
+	unsigned long	dirs;		/* directories read */
+	unsigned long	entries;	/* names seen by the walk */
+	unsigned long	stats;		/* calls of the stat() family */
+	unsigned long	state[RNM_REP_MAX];	/* the reported files */
+	unsigned long	c_hit;		/* the name cache */
+	unsigned long	c_miss;
+	unsigned long	dc_hit;		/* directories not read, see dircache.c */
+	double	match;		/* seconds of matching the names */
+	double	exec;		/* seconds of the jobs */
+	double	cpu;		/* CPU seconds of the workers */
+	int	workers;
+	struct	_RNMHIST	*hist;	/* the latency, NULL if not recorded */
+} RNMSTATS;
+
+/* a renaming job could be done right away or by the workers */
+typedef	struct	_RNMJOB	{
+	struct	_RNMJOB	*next;
+	RNMDIR	*dir;
+	char	*dest;		/* NULL if the name is unchanged */
+	char	*sour;
+	int	room;		/* free space after the dest */
+	int	attr;		/* change the ownership or the permission */
+	int	stated;		/* the stat below was known by the walk */
+	int	pooled;		/* taken from the pool, or malloc() */
+	uid_t	st_uid;
+	gid_t	st_gid;
+	mode_t	st_mode;
+	struct	timespec	start;	/* only for --output */
+	RNMSTATS	*stats;		/* of the thread doing the job */
+} RNMJOB;
+
+/* one clause of the --mode, like "g+w" or "o=". The octal mode is one
+   clause of '=' on all bits */
+#define RNM_MODE_MAX		16
+
+typedef	struct	{
+	mode_t	who;		/* the bits cleared by '=' */
+	mode_t	mask;		/* the bits could be set, the umask applied */
+	mode_t	perm;
+	int	op;		/* '+', '-' or '=' */
+	int	cond_x;		/* 'X' was given */
+} RNMMODE;
+
+/* the compiled rules, which are read-only after compiled so they could be
+   shared by any number of contexts and workers */
 typedef	struct	{
 	int	oflags;
-	int	cflags;
+	int	cflags;		/* the initial flags of the contexts */
 	int	action;
 
 	uid_t	pw_uid;
 	gid_t	pw_gid;
+	RNMMODE	mode[RNM_MODE_MAX];
+	int	md_num;
 
 	char	*pattern;
 	int	pa_len;
@@ -85,21 +190,161 @@ typedef	struct	{
 
 	int	(*compare)(const char *s1, const char *s2, size_t n);
 
-	char	buffer[FNBUF];		/* hope that's big enough */
+	struct	_RNMFILTER	*filter;	/* see filter.c */
+	int	mindepth;
+	int	maxdepth;	/* -1 = unlimited */
+
+	unsigned long long	hash;	/* of the options, see dircache.c */
+} RNMRULE;
+
+/* the context of the renaming calls, see librenamex.h. It's the scratch
+   of the thread walking the names; the workers read the rule and write
+   nothing here but the atomic 'rpcnt' and what is behind the locks */
+typedef	struct	_RENOP	{
+	const	RNMRULE	*rule;
+	int	cflags;		/* the rule's, changed by the answers */
+
+	char	*buffer;	/* the new name, grown as it needs */
+	int	bufsize;
 	int	room;
 	int	rpcnt;
+
+	RNMARENA	arena;		/* the names of the walk */
+	RNMPOOL		jobs;		/* for the workers, RNM_JOB_SIZE */
+
+	struct	_RNMCACHE	*cache;	/* basename transform cache */
+	struct	_RNMDCACHE	*dircache;	/* see dircache.c */
+	RNMSTATS	stats;		/* of the walk, and the workers at last */
+
+	int	depth;		/* depth of the current directory entries */
+	dev_t	xdev;		/* file system of the starting point */
+
+	struct	_RNMSCHED	*sched;	/* parallel workers, see sched.c */
+	RNMDIR	*dir;		/* the directory in process */
+	RNMDIR	topdir;		/* where the command line names are */
+	RNMBUCKET	ops_tb;		/* renames and chowns per second */
+	RNMBUCKET	dir_tb;		/* directories read per second */
+
+	struct	_RNMOUTPUT	*output;	/* see output.c */
+	int	outfmt;		/* RNM_OUT_TEXT, ... */
+
+	RNMCALLBACK	cb;
 } RENOP;
 
 
 #define strcmp_list(dst,s1,s2)	(strcmp((dst),(s1)) && strcmp((dst),(s2)))
 
 int rename_enfile(RENOP *opt, char *filename);
-int rename_entry(RENOP *opt, char *filename);
+int rename_entry(RENOP *opt, int dfd, char *filename);
+int rename_topdir(RENOP *opt, int dfd, char *path);
+int rename_finish(RENOP *opt);
+int rename_job(RENOP *opt, RNMJOB *job);
+void rename_job_free(RENOP *opt, RNMJOB *job);
 
 int safe_copy(char *dest, const char *src, size_t n);
 int safe_cat(char *dest, const char *src, size_t n);
 char *skip_space(char *sour);
 
+/* see match.c */
+
+int rename_pattern(RNMRULE *rule, char *optarg);
+int match_regexpr(const RNMRULE *rule, char *fname, int flen, int *room);
+int match_forward(const RNMRULE *rule, char *fname, int flen, int *room);
+int match_backward(const RNMRULE *rule, char *fname, int flen, int *room);
+int match_suffix(const RNMRULE *rule, char *fname, int flen, int *room);
+int inject(char *rec, int rlen, int del, int room, char *in, int ilen);
+
+/* see cache.c */
+
+unsigned rename_hash(const char *s, int len);
+int rename_cache_open(RENOP *opt, int slots);
+void rename_cache_close(RENOP *opt);
+int rename_cache_lookup(RENOP *opt, const char *name, int nlen, 
+		const char **newname);
+void rename_cache_store(RENOP *opt, const char *name, int nlen,
+		const char *newname, int state);
+
+/* see casemap.c */
+
+void rename_case_init(void);
+int rename_lowercase(char *s, int len, int *room);
+int rename_uppercase(char *s, int len, int *room);
+int rename_case_check(const char *s, int len, int upper);
+
+/* see normal.c */
+
+int rename_norm_check(const char *s, int len, int nfd);
+int rename_normalize(char *s, int len, int nfd, int *room);
+
+/* see filter.c */
+
+int rename_filter_add(RNMRULE *rule, int type, const char *glob);
+int rename_filter_compile(RNMRULE *rule);
+void rename_filter_free(RNMRULE *rule);
+int rename_filter_count(const RNMRULE *rule, int type);
+int rename_filter_match(const RNMRULE *rule, int type, const char *name);
+
+/* see sched.c */
+
+int rename_sched_limit(RENOP *opt, const char *path, int jobs, double ops);
+void rename_sched_close(RENOP *opt);
+int rename_sched_submit(RENOP *opt, RNMJOB *job);
+int rename_sched_wait(RENOP *opt, RNMDIR *dir);
+int rename_sched_error(RENOP *opt, RNMDIR *dir);
+void rename_bucket_init(RNMBUCKET *tb, double rate);
+void rename_bucket_free(RNMBUCKET *tb);
+void rename_bucket_take(RNMBUCKET *tb);
+int rename_ioprio(int ioclass, int level);
+
+/* see arena.c */
+void *rename_arena_alloc(RNMARENA *ar, size_t len);
+void rename_arena_mark(RNMARENA *ar, RNMMARK *mark);
+void rename_arena_release(RNMARENA *ar, RNMMARK *mark);
+void rename_arena_free(RNMARENA *ar);
+void rename_pool_init(RNMPOOL *pool, size_t size);
+void *rename_pool_get(RNMPOOL *pool);
+void rename_pool_put(RNMPOOL *pool, void *obj);
+void rename_pool_free(RNMPOOL *pool);
+
+/* see dircache.c */
+struct	stat;
+int rename_dircache_open(RENOP *opt, const char *path);
+int rename_dircache_close(RENOP *opt);
+const char *rename_dircache_lookup(RENOP *opt, struct stat *fs, int *nsub);
+void rename_dircache_store(RENOP *opt, struct stat *fs, const char *subs,
+		int len, int nsub);
+
+/* see output.c */
+int rename_output_open(RENOP *opt, int fd, int async, int progress);
+void rename_output_close(RENOP *opt);
+void rename_output_flush(RENOP *opt);
+void rename_output_abort(RENOP *opt);
+void rename_output_write(RENOP *opt, const char *s, int len);
+int rename_output_count(RENOP *opt, int state);
+int rename_output_format(const char *name);
+void rename_output_record(RENOP *opt, RNMJOB *job, char *dest, char *sour,
+		int state, int err);
+char *rename_output_json(char *p, const char *path);
+
+/* see serve.c */
+int rename_serve(const char *path);
+
+/* see watch.c */
+int rename_watch_open(RENOP *opt, char **argv, int argc, int delay);
+int rename_watch(RENOP *opt);
+
+/* see stats.c */
+double rename_stats_clock(void);
+double rename_stats_cpu(void);
+void rename_stats_merge(RNMSTATS *to, RNMSTATS *from);
+void rename_stats_report(RENOP *opt, FILE *fp, double wall, double cpu);
+int rename_stats_hist(RNMSTATS *st);
+void rename_stats_free(RNMSTATS *st);
+unsigned long long rename_lat_start(RNMSTATS *st);
+void rename_lat_stop(RNMSTATS *st, int type, unsigned long long start);
+void rename_stats_latency(RENOP *opt, FILE *fp);
+int rename_stats_dump(RENOP *opt, const char *path);
+
 /* see fixtoken.c */
 
 int fixtoken(char *sour, char **idx, int ids, char *delim);
@@ -0,0 +1,408 @@
+/*  sched.c - the per file system I/O scheduler of the parallel renaming
+
+    Copyright (C) 1998-2011  "Andy Xuming" <xuming@users.sourceforge.net>
+
+    This file is part of RENAME, a utility to help file renaming
+
+    RENAME is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    RENAME is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#if STDC_HEADERS
+  #include <string.h>
+#endif
+
+#if HAVE_UNISTD_H
+  #include <sys/types.h>
+  #include <unistd.h>
+#endif
+
+#ifdef	__linux__
+  #include <sys/syscall.h>
+#endif
+
+/* from linux/ioprio.h, which older systems may not have */
+#define IOPRIO_WHO_PROC		1
+#define IOPRIO_SHIFT		13
+
+#if HAVE_REGEX_H
+  #include <regex.h>
+#else
+  #include "regex.h"
+#endif
+
+#include "rename.h"
+
+/* The renaming jobs are queued by the file system (st_dev) they work on.
+   Every file system has its own queue, its own group of worker threads,
+   whose number is the concurrency limit of the file system, and its own
+   token bucket if the operations per second were limited. So a slow
+   network mount gets a couple of workers while a local SSD gets many,
+   and neither of them waits for the other.
+   The traversal waits for all jobs of a directory before leaving it, so
+   a directory is never renamed before its contents. */
+typedef	struct	_RNMLIMIT	{
+	struct	_RNMLIMIT	*next;
+	dev_t	dev;
+	int	jobs;
+	double	ops;
+} RNMLIMIT;
+
+typedef	struct	_RNMDEV	{
+	struct	_RNMDEV		*next;
+	struct	_RNMSCHED	*sched;
+	dev_t		dev;
+	int		jobs;
+	RNMBUCKET	bucket;
+	RNMJOB		*head;
+	RNMJOB		*tail;
+	int		quit;
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;
+	pthread_t	*worker;
+	int		workers;
+} RNMDEV;
+
+struct	_RNMSCHED	{
+	RENOP		*opt;
+	RNMLIMIT	*limit;
+	RNMDEV		*devs;
+	int		jobs;		/* default workers per file system */
+	double		ops;		/* default operations per second */
+	pthread_mutex_t	lock;		/* the device list and the batches */
+	pthread_cond_t	done;		/* some job was finished */
+};
+
+
+static RNMDEV *sched_device(struct _RNMSCHED *sched, dev_t dev);
+static void *sched_worker(void *arg);
+
+
+/* set the limits of the file system where 'path' is; or the default limits
+   if 'path' is NULL. 'ops' is the operations per second, 0 is unlimited */
+int rename_sched_limit(RENOP *opt, const char *path, int jobs, double ops)
+{
+	struct	_RNMSCHED	*sched;
+	RNMLIMIT	*limit;
+	struct	stat	fs;
+
+	if ((sched = opt->sched) == NULL) {
+		if ((sched = calloc(1, sizeof(struct _RNMSCHED))) == NULL) {
+			return RNM_ERR_LOWMEM;
+		}
+		pthread_mutex_init(&sched->lock, NULL);
+		pthread_cond_init(&sched->done, NULL);
+		sched->opt  = opt;
+		sched->jobs = 1;
+		opt->sched  = sched;
+	}
+	if (path == NULL) {
+		sched->jobs = (jobs > 0) ? jobs : 1;
+		sched->ops  = ops;
+		return RNM_ERR_NONE;
+	}
+	if (stat(path, &fs) < 0) {
+		return RNM_ERR_STAT;
+	}
+	if ((limit = malloc(sizeof(RNMLIMIT))) == NULL) {
+		return RNM_ERR_LOWMEM;
+	}
+	limit->dev  = fs.st_dev;
+	limit->jobs = (jobs > 0) ? jobs : 1;
+	limit->ops  = ops;
+	limit->next = sched->limit;
+	sched->limit = limit;
+	return RNM_ERR_NONE;
+}
+
+/* wait for all workers to finish their queues and release everything */
+void rename_sched_close(RENOP *opt)
+{
+	struct	_RNMSCHED	*sched = opt->sched;
+	RNMLIMIT	*limit;
+	RNMDEV		*dev;
+	int	i;
+
+	if (sched == NULL) {
+		return;
+	}
+	while ((dev = sched->devs) != NULL) {
+		pthread_mutex_lock(&dev->lock);
+		dev->quit = 1;
+		pthread_cond_broadcast(&dev->cond);
+		pthread_mutex_unlock(&dev->lock);
+		for (i = 0; i < dev->workers; i++) {
+			pthread_join(dev->worker[i], NULL);
+		}
+		sched->devs = dev->next;
+		pthread_mutex_destroy(&dev->lock);
+		pthread_cond_destroy(&dev->cond);
+		rename_bucket_free(&dev->bucket);
+		free(dev->worker);
+		free(dev);
+	}
+	while ((limit = sched->limit) != NULL) {
+		sched->limit = limit->next;
+		free(limit);
+	}
+	pthread_mutex_destroy(&sched->lock);
+	pthread_cond_destroy(&sched->done);
+	free(sched);
+	opt->sched = NULL;
+}
+
+/* queue the job to the workers of the file system of its directory. The
+   job is made by rename_dispatch() and freed by the worker */
+int rename_sched_submit(RENOP *opt, RNMJOB *job)
+{
+	RNMDEV	*dev;
+
+	pthread_mutex_lock(&opt->sched->lock);
+	dev = sched_device(opt->sched, job->dir->dev);
+	if (dev) {
+		job->dir->pending++;
+	}
+	pthread_mutex_unlock(&opt->sched->lock);
+	if (dev == NULL) {
+		return RNM_ERR_LOWMEM;
+	}
+
+	job->next = NULL;
+	pthread_mutex_lock(&dev->lock);
+	if (dev->tail) {
+		dev->tail->next = job;
+	} else {
+		dev->head = job;
+	}
+	dev->tail = job;
+	pthread_cond_signal(&dev->cond);
+	pthread_mutex_unlock(&dev->lock);
+	return RNM_ERR_NONE;
+}
+
+/* wait until all jobs of the directory were done. It returns the first
+   error of those jobs */
+int rename_sched_wait(RENOP *opt, RNMDIR *dir)
+{
+	int	rc;
+
+	if (opt->sched == NULL) {
+		return dir->rc;
+	}
+	pthread_mutex_lock(&opt->sched->lock);
+	while (dir->pending) {
+		pthread_cond_wait(&opt->sched->done, &opt->sched->lock);
+	}
+	rc = dir->rc;
+	pthread_mutex_unlock(&opt->sched->lock);
+	return rc;
+}
+
+/* return the first error of the jobs of the directory so far */
+int rename_sched_error(RENOP *opt, RNMDIR *dir)
+{
+	int	rc;
+
+	pthread_mutex_lock(&opt->sched->lock);
+	rc = dir->rc;
+	pthread_mutex_unlock(&opt->sched->lock);
+	return rc;
+}
+
+/* find the queue of the file system, or create it with its workers. It's
+   called with the scheduler locked */
+static RNMDEV *sched_device(struct _RNMSCHED *sched, dev_t devno)
+{
+	RNMLIMIT	*limit;
+	RNMDEV		*dev;
+	double		ops;
+
+	for (dev = sched->devs; dev; dev = dev->next) {
+		if (dev->dev == devno) {
+			return dev;
+		}
+	}
+	if ((dev = calloc(1, sizeof(RNMDEV))) == NULL) {
+		return NULL;
+	}
+	dev->sched = sched;
+	dev->dev   = devno;
+	dev->jobs  = sched->jobs;
+	ops = sched->ops;
+	for (limit = sched->limit; limit; limit = limit->next) {
+		if (limit->dev == devno) {
+			dev->jobs = limit->jobs;
+			ops = limit->ops;
+			break;
+		}
+	}
+	rename_bucket_init(&dev->bucket, ops);
+	pthread_mutex_init(&dev->lock, NULL);
+	pthread_cond_init(&dev->cond, NULL);
+	if ((dev->worker = calloc(dev->jobs, sizeof(pthread_t))) == NULL) {
+		free(dev);
+		return NULL;
+	}
+	for (dev->workers = 0; dev->workers < dev->jobs; dev->workers++) {
+		if (pthread_create(&dev->worker[dev->workers], NULL,
+					sched_worker, dev)) {
+			break;
+		}
+	}
+	if (dev->workers == 0) {
+		free(dev->worker);
+		free(dev);
+		return NULL;
+	}
+	dev->next = sched->devs;
+	sched->devs = dev;
+	return dev;
+}
+
+static void *sched_worker(void *arg)
+{
+	RNMDEV	*dev = arg;
+	struct	_RNMSCHED	*sched = dev->sched;
+	RNMSTATS	stats;
+	RNMJOB	*job;
+	int	rc;
+
+	memset(&stats, 0, sizeof(stats));
+	stats.workers = 1;
+	if (sched->opt->stats.hist) {
+		rename_stats_hist(&stats);
+	}
+	while (1) {
+		pthread_mutex_lock(&dev->lock);
+		while ((dev->head == NULL) && !dev->quit) {
+			pthread_cond_wait(&dev->cond, &dev->lock);
+		}
+		if ((job = dev->head) == NULL) {
+			pthread_mutex_unlock(&dev->lock);
+			break;		/* quit when the queue is empty */
+		}
+		if ((dev->head = job->next) == NULL) {
+			dev->tail = NULL;
+		}
+		pthread_mutex_unlock(&dev->lock);
+
+		/* stop working on a directory once a job of it failed, just
+		 * like the sequential renaming does */
+		if (rename_sched_error(sched->opt, job->dir) == RNM_ERR_NONE) {
+			rename_bucket_take(&dev->bucket);
+			job->stats = &stats;
+			rc = rename_job(sched->opt, job);
+		} else {
+			rc = RNM_ERR_NONE;
+		}
+
+		pthread_mutex_lock(&sched->lock);
+		if ((rc != RNM_ERR_NONE) && (job->dir->rc == RNM_ERR_NONE)) {
+			job->dir->rc = rc;
+		}
+		job->dir->pending--;
+		pthread_cond_broadcast(&sched->done);
+		pthread_mutex_unlock(&sched->lock);
+		rename_job_free(sched->opt, job);
+	}
+
+	/* the walk is over when the workers quit */
+	stats.cpu = rename_stats_cpu();
+	pthread_mutex_lock(&sched->lock);
+	rename_stats_merge(&sched->opt->stats, &stats);
+	pthread_mutex_unlock(&sched->lock);
+	rename_stats_free(&stats);
+	return NULL;
+}
+
+
+/* A token bucket of the operations per second. It allows a burst of one
+   second worth of tokens, then the callers are spaced by the rate. */
+void rename_bucket_init(RNMBUCKET *tb, double rate)
+{
+	memset(tb, 0, sizeof(RNMBUCKET));
+	if ((tb->rate = rate) > 0) {
+		tb->tokens = rate;
+		clock_gettime(CLOCK_MONOTONIC, &tb->last);
+		tb->lock = malloc(sizeof(pthread_mutex_t));
+		if (tb->lock) {
+			pthread_mutex_init(tb->lock, NULL);
+		}
+	}
+}
+
+void rename_bucket_free(RNMBUCKET *tb)
+{
+	if (tb->lock) {
+		pthread_mutex_destroy(tb->lock);
+		free(tb->lock);
+		tb->lock = NULL;
+	}
+}
+
+void rename_bucket_take(RNMBUCKET *tb)
+{
+	struct	timespec	now, nap;
+	double	wait;
+
+	if ((tb->rate <= 0) || (tb->lock == NULL)) {
+		return;
+	}
+	pthread_mutex_lock(tb->lock);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	tb->tokens += (now.tv_sec - tb->last.tv_sec) * tb->rate +
+		(now.tv_nsec - tb->last.tv_nsec) / 1e9 * tb->rate;
+	if (tb->tokens > tb->rate) {
+		tb->tokens = tb->rate;
+	}
+	tb->last = now;
+	tb->tokens -= 1.0;	/* reserve the token, even in debt */
+	wait = (tb->tokens < 0) ? -tb->tokens / tb->rate : 0;
+	pthread_mutex_unlock(tb->lock);
+
+	if (wait > 0) {
+		nap.tv_sec  = (time_t) wait;
+		nap.tv_nsec = (long)((wait - nap.tv_sec) * 1e9);
+		while (nanosleep(&nap, &nap) < 0 && (errno == EINTR));
+	}
+}
+
+/* set the I/O scheduling class of the process, like ionice(1) does. The
+   threads created afterwards inherit it. The 'level' is 0-7 for the
+   realtime and the best-effort classes. */
+int rename_ioprio(int ioclass, int level)
+{
+#ifdef	SYS_ioprio_set
+	if (ioclass == RNM_IOPRIO_IDLE) {
+		level = 0;
+	}
+	if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROC, 0, 
+				(ioclass << IOPRIO_SHIFT) | level) < 0) {
+		return RNM_ERR_EUID;
+	}
+	return RNM_ERR_NONE;
+#else
+	return RNM_ERR_PARAM;
+#endif
+}
@@ -0,0 +1,492 @@
+/*  serve.c - the daemon mode, renaming by requests over a Unix socket
+
+    Copyright (C) 1998-2011  "Andy Xuming" <xuming@users.sourceforge.net>
+
+    This file is part of RENAME, a utility to help file renaming
+
+    RENAME is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    RENAME is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#if STDC_HEADERS
+  #include <string.h>
+#endif
+
+#if HAVE_UNISTD_H
+  #include <sys/types.h>
+  #include <unistd.h>
+#endif
+
+#if HAVE_REGEX_H
+  #include <regex.h>
+#else
+  #include "regex.h"
+#endif
+
+#include "rename.h"
+
+/* A client sends the requests as blocks of lines, each block ended by an
+   empty line, and reads a JSON object per line back:
+
+	RULES				{"rules":"9c1f0e3a5b7d2e41","cached":false}
+	pattern=/.jpeg/.jpg/s
+	never
+
+	RENAME 9c1f0e3a5b7d2e41		{"src":...,"state":"done",...}
+	/photos/IMG_0001.jpeg		...
+	/photos/IMG_0002.jpeg		{"done":2,"skip":0,"fail":0,"errors":0}
+
+   The lines of RULES are the long options of renamex(1) without the
+   dashes, with the value after '='. The ruleset is compiled once and kept
+   by the hash of its lines, so the same RULES costs a lookup afterwards,
+   and the id stays valid while the daemon runs unless it is pushed out by
+   SERVE_RULES newer rulesets. A RENAME runs the paths in a context of its
+   own and answers the --output jsonl records of the files, a line for
+   the paths which could not be done at all, and the counters at last.
+   Every connection is served by a thread; the rulesets are shared. */
+#define SERVE_RULES	64
+#define SERVE_BACKLOG	16
+
+typedef	struct	{
+	unsigned long long	id;
+	char		*text;		/* the lines of RULES */
+	RNMRULES	*rules;
+	int		refs;		/* the requests running by it */
+	unsigned long	used;		/* the clock of the last use */
+} SVRULES;
+
+static	struct	{
+	pthread_mutex_t	lock;
+	SVRULES		slot[SERVE_RULES];
+	unsigned long	clock;
+	const char	*path;
+} serve = { PTHREAD_MUTEX_INITIALIZER };
+
+static int serve_listen(const char *path);
+static void serve_unlink(void);
+static void *serve_client(void *arg);
+static int serve_rules(int fd, FILE *fp);
+static int serve_rename(int fd, FILE *fp, char *idstr);
+static SVRULES *serve_lookup(unsigned long long id, const char *text);
+static SVRULES *serve_insert(unsigned long long id, char *text,
+		RNMRULES *rules);
+static void serve_release(SVRULES *sr);
+static int serve_getline(FILE *fp, char **line, size_t *size);
+static void serve_reply(int fd, const char *fmt, ...);
+static void serve_write(int fd, const char *s, int len);
+static void serve_error(int fd, const char *path, int err);
+
+
+/* serve the requests on the socket 'path' until killed */
+int rename_serve(const char *path)
+{
+	pthread_t	tid;
+	int	sfd, cfd, *arg;
+
+	if ((sfd = serve_listen(path)) < 0) {
+		perror(path);
+		return RNM_ERR_OPENFILE;
+	}
+	serve.path = path;
+	atexit(serve_unlink);
+	signal(SIGPIPE, SIG_IGN);	/* a client gone is found by write() */
+
+	while (1) {
+		if ((cfd = accept(sfd, NULL, NULL)) < 0) {
+			if ((errno == EINTR) || (errno == ECONNABORTED)) {
+				continue;
+			}
+			perror(path);
+			break;
+		}
+		if ((arg = malloc(sizeof(int))) == NULL) {
+			close(cfd);
+			continue;
+		}
+		*arg = cfd;
+		if (pthread_create(&tid, NULL, serve_client, arg)) {
+			close(cfd);
+			free(arg);
+			continue;
+		}
+		pthread_detach(tid);
+	}
+	close(sfd);
+	return RNM_ERR_OPENFILE;
+}
+
+/* the socket is only for the owner since the daemon renames anything the
+   owner could. A socket left by a dead daemon is taken over */
+static int serve_listen(const char *path)
+{
+	struct	sockaddr_un	addr;
+	mode_t	mask;
+	int	fd, rc, probe;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (safe_copy(addr.sun_path, path, sizeof(addr.sun_path)) < 0) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+		return -1;
+	}
+	mask = umask(077);
+	rc = bind(fd, (struct sockaddr *) &addr, sizeof(addr));
+	if ((rc < 0) && (errno == EADDRINUSE) &&
+			((probe = socket(AF_UNIX, SOCK_STREAM, 0)) >= 0)) {
+		if ((connect(probe, (struct sockaddr *) &addr,
+				sizeof(addr)) < 0) && (errno == ECONNREFUSED)) {
+			unlink(path);
+			rc = bind(fd, (struct sockaddr *) &addr, sizeof(addr));
+		} else {
+			errno = EADDRINUSE;
+		}
+		close(probe);
+	}
+	umask(mask);
+	if ((rc < 0) || (listen(fd, SERVE_BACKLOG) < 0)) {
+		rc = errno;
+		close(fd);
+		errno = rc;
+		return -1;
+	}
+	return fd;
+}
+
+static void serve_unlink(void)
+{
+	if (serve.path) {
+		unlink(serve.path);
+	}
+}
+
+static void *serve_client(void *arg)
+{
+	FILE	*fp;
+	char	*line = NULL;
+	size_t	size = 0;
+	int	fd = *(int *) arg;
+
+	free(arg);
+	if ((fp = fdopen(dup(fd), "r")) == NULL) {
+		close(fd);
+		return NULL;
+	}
+	while (serve_getline(fp, &line, &size) >= 0) {
+		if (*line == 0) {
+			continue;
+		}
+		if (!strcmp(line, "RULES")) {
+			serve_rules(fd, fp);
+		} else if (!strncmp(line, "RENAME ", 7)) {
+			serve_rename(fd, fp, line + 7);
+		} else {
+			serve_reply(fd, "{\"error\":%d,\"message\":\"%s\"}\n",
+					RNM_ERR_PARAM, "Unknown request");
+			break;
+		}
+	}
+	free(line);
+	fclose(fp);
+	close(fd);
+	return NULL;
+}
+
+/* read the lines of the ruleset; it's compiled unless it was cached */
+static int serve_rules(int fd, FILE *fp)
+{
+	SVRULES	*sr;
+	RNMRULES	*rules;
+	unsigned long long	id = 14695981039346656037ULL;	/* FNV-1a */
+	char	*line = NULL, *text = NULL, *value, *p;
+	size_t	size = 0, tlen = 0;
+	int	len, rc = RNM_ERR_NONE;
+
+	while ((len = serve_getline(fp, &line, &size)) > 0) {
+		if ((p = realloc(text, tlen + len + 2)) == NULL) {
+			rc = RNM_ERR_LOWMEM;
+			continue;
+		}
+		text = p;
+		memcpy(text + tlen, line, len);
+		tlen += len;
+		text[tlen++] = '\n';
+		text[tlen] = 0;
+	}
+	free(line);
+	if (rc != RNM_ERR_NONE) {
+		free(text);
+		serve_error(fd, NULL, rc);
+		return rc;
+	}
+	if (text == NULL) {
+		serve_error(fd, NULL, RNM_ERR_PARAM);
+		return RNM_ERR_PARAM;
+	}
+	for (p = text; *p; p++) {
+		id = (id ^ (unsigned char) *p) * 1099511628211ULL;
+	}
+
+	if ((sr = serve_lookup(id, text)) != NULL) {
+		free(text);
+		serve_reply(fd, "{\"rules\":\"%016llx\",\"cached\":true}\n", id);
+		serve_release(sr);
+		return RNM_ERR_NONE;
+	}
+
+	/* the values are copied by the ruleset, so the text is split here */
+	if ((rules = renamex_rules_new()) == NULL) {
+		free(text);
+		serve_error(fd, NULL, RNM_ERR_LOWMEM);
+		return RNM_ERR_LOWMEM;
+	}
+	for (p = text; (rc == RNM_ERR_NONE) && *p; p = line) {
+		line  = strchr(p, '\n');
+		*line++ = 0;
+		if ((value = strchr(p, '=')) != NULL) {
+			*value++ = 0;
+		}
+		rc = renamex_rules_set(rules, p, value);
+		if (value) {
+			value[-1] = '=';
+		}
+		line[-1] = '\n';
+	}
+	if (rc == RNM_ERR_NONE) {
+		rc = renamex_rules_compile(rules);
+	}
+	if ((rc == RNM_ERR_NONE) &&
+			((sr = serve_insert(id, text, rules)) == NULL)) {
+		rc = RNM_ERR_LOWMEM;
+	}
+	if (rc != RNM_ERR_NONE) {
+		renamex_rules_free(rules);
+		free(text);
+		serve_error(fd, NULL, rc);
+		return rc;
+	}
+	serve_reply(fd, "{\"rules\":\"%016llx\",\"cached\":false}\n", id);
+	serve_release(sr);
+	return RNM_ERR_NONE;
+}
+
+/* rename the paths by the ruleset of 'idstr' in a context of the request,
+   which writes the records to the client directly */
+static int serve_rename(int fd, FILE *fp, char *idstr)
+{
+	RENOP	*opt = NULL;
+	SVRULES	*sr;
+	char	*line = NULL, *end;
+	size_t	size = 0;
+	unsigned long long	id;
+	int	rc = RNM_ERR_NONE, err, errors = 0;
+
+	id = strtoull(idstr, &end, 16);
+	if (*end || ((sr = serve_lookup(id, NULL)) == NULL)) {
+		rc = RNM_ERR_PARAM;
+	} else if ((opt = renamex_open(sr->rules, NULL)) == NULL) {
+		serve_release(sr);
+		rc = RNM_ERR_LOWMEM;
+	} else {
+		opt->outfmt = RNM_OUT_JSONL;
+		rc = rename_output_open(opt, fd, 0, 0);
+	}
+
+	while (serve_getline(fp, &line, &size) > 0) {
+		if ((rc != RNM_ERR_NONE) || (*line == 0)) {
+			continue;	/* the block is read anyway */
+		}
+		if ((err = renamex_rename(opt, AT_FDCWD, line)) != 
+				RNM_ERR_NONE) {
+			rename_output_flush(opt);
+			serve_error(fd, line, err);
+			errors++;
+		}
+	}
+	free(line);
+
+	if (rc != RNM_ERR_NONE) {
+		serve_error(fd, NULL, rc);
+	} else {
+		if (renamex_finish(opt) != RNM_ERR_NONE) {
+			errors++;
+		}
+		rename_output_close(opt);
+		serve_reply(fd, "{\"done\":%d,\"skip\":%lu,\"fail\":%lu,"
+				"\"errors\":%d}\n", opt->rpcnt,
+				renamex_count(opt, RNM_REP_SKIP),
+				renamex_count(opt, RNM_REP_FAILED), errors);
+	}
+	if (opt) {
+		renamex_close(opt);
+		serve_release(sr);
+	}
+	return rc;
+}
+
+/* find the ruleset and hold it, or NULL. The 'text' is compared as well
+   if given, since two rulesets could have the same hash */
+static SVRULES *serve_lookup(unsigned long long id, const char *text)
+{
+	SVRULES	*sr = NULL;
+	int	i;
+
+	pthread_mutex_lock(&serve.lock);
+	for (i = 0; i < SERVE_RULES; i++) {
+		if (serve.slot[i].rules && (serve.slot[i].id == id) &&
+				(!text || !strcmp(serve.slot[i].text, text))) {
+			sr = &serve.slot[i];
+			sr->refs++;
+			sr->used = ++serve.clock;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&serve.lock);
+	return sr;
+}
+
+/* keep the ruleset in a free slot, or the least recently used one which
+   is not running. It's returned held, or NULL if all slots are busy */
+static SVRULES *serve_insert(unsigned long long id, char *text,
+		RNMRULES *rules)
+{
+	SVRULES	*sr = NULL;
+	int	i;
+
+	pthread_mutex_lock(&serve.lock);
+	for (i = 0; i < SERVE_RULES; i++) {
+		if (serve.slot[i].rules && (serve.slot[i].id == id) &&
+				!strcmp(serve.slot[i].text, text)) {
+			sr = NULL;	/* compiled by another client */
+			break;
+		}
+		if (serve.slot[i].refs) {
+			continue;
+		}
+		if (!sr || !serve.slot[i].rules || (sr->rules &&
+				(serve.slot[i].used < sr->used))) {
+			sr = &serve.slot[i];
+		}
+	}
+	if (i < SERVE_RULES) {
+		/* the one compiled first is kept */
+		renamex_rules_free(rules);
+		free(text);
+		sr = &serve.slot[i];
+	} else if (sr) {
+		if (sr->rules) {
+			renamex_rules_free(sr->rules);
+			free(sr->text);
+		}
+		sr->id    = id;
+		sr->text  = text;
+		sr->rules = rules;
+	}
+	if (sr) {
+		sr->refs++;
+		sr->used = ++serve.clock;
+	}
+	pthread_mutex_unlock(&serve.lock);
+	return sr;
+}
+
+static void serve_release(SVRULES *sr)
+{
+	pthread_mutex_lock(&serve.lock);
+	sr->refs--;
+	pthread_mutex_unlock(&serve.lock);
+}
+
+/* a line without the newline. It returns its length, or -1 at the end */
+static int serve_getline(FILE *fp, char **line, size_t *size)
+{
+	ssize_t	len;
+
+	if ((len = getline(line, size, fp)) < 0) {
+		return -1;
+	}
+	if ((len > 0) && ((*line)[len - 1] == '\n')) {
+		(*line)[--len] = 0;
+	}
+	return (int) len;
+}
+
+static void serve_reply(int fd, const char *fmt, ...)
+{
+	va_list	ap;
+	char	buf[256];
+	int	len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	if (len >= (int) sizeof(buf)) {
+		len = sizeof(buf) - 1;
+	}
+	serve_write(fd, buf, len);
+}
+
+static void serve_write(int fd, const char *s, int len)
+{
+	int	n;
+
+	while (len > 0) {
+		if ((n = write(fd, s, len)) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;		/* the client is gone */
+		}
+		s   += n;
+		len -= n;
+	}
+}
+
+/* the error of the request, or of the 'path' which was not done at all */
+static void serve_error(int fd, const char *path, int err)
+{
+	char	*buf, *p;
+
+	if ((buf = malloc((path ? strlen(path) * 6 : 0) + 128)) == NULL) {
+		return;
+	}
+	p = buf;
+	if (path) {
+		memcpy(p, "{\"src\":", 7);
+		p = rename_output_json(p + 7, path);
+		*p++ = ',';
+	} else {
+		*p++ = '{';
+	}
+	p += sprintf(p, "\"error\":%d,\"message\":\"%s\"}\n", err,
+			renamex_strerror(err));
+	serve_write(fd, buf, p - buf);
+	free(buf);
+}
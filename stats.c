@@ -0,0 +1,317 @@
+/*  stats.c - the counters and the timings of --stats
+
+    Copyright (C) 1998-2011  "Andy Xuming" <xuming@users.sourceforge.net>
+
+    This file is part of RENAME, a utility to help file renaming
+
+    RENAME is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    RENAME is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#if HAVE_UNISTD_H
+  #include <sys/types.h>
+#endif
+
+#if HAVE_REGEX_H
+  #include <regex.h>
+#else
+  #include "regex.h"
+#endif
+
+#include "rename.h"
+
+/* Every thread counts into its own RNMSTATS: the walk into the one of the
+   RENOP, each worker into a local one which is added to the RENOP when the
+   worker quits. So the counters need neither locks nor atomics.
+   The CPU time of the walk thread is split into the traversal and the
+   matching by their wall time, since asking the CPU time of the thread
+   for every file costs a system call. The workers' CPU time is measured
+   when they quit. */
+
+/* The latency histograms are log bucketed like HdrHistogram: every power
+   of two is divided into 16 linear sub-buckets, so any latency from 1ns
+   to about 18 minutes is kept within 6% in a fixed array, and recording
+   one is a shift and an increment. The exact maximum is kept aside. */
+#define HIST_SUBBITS	4
+#define HIST_SUB	(1 << HIST_SUBBITS)
+#define HIST_MAXBITS	40
+#define HIST_BUCKETS	((HIST_MAXBITS - HIST_SUBBITS + 1) * HIST_SUB + HIST_SUB)
+
+struct	_RNMHIST	{
+	unsigned long		count[RNM_LAT_MAX][HIST_BUCKETS];
+	unsigned long long	max[RNM_LAT_MAX];
+};
+
+static	char	*lat_name[RNM_LAT_MAX] = {
+	"readdir", "stat", "rename", "chown", "chmod"
+};
+
+static int hist_index(unsigned long long ns);
+static unsigned long long hist_value(int idx);
+
+double rename_stats_clock(void)
+{
+	struct	timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* the CPU time of the calling thread */
+double rename_stats_cpu(void)
+{
+	struct	timespec	ts;
+
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) < 0) {
+		return 0;
+	}
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void rename_stats_merge(RNMSTATS *to, RNMSTATS *from)
+{
+	int	i, k;
+
+	to->dirs    += from->dirs;
+	to->entries += from->entries;
+	to->stats   += from->stats;
+	for (i = 0; i < RNM_REP_MAX; i++) {
+		to->state[i] += from->state[i];
+	}
+	to->c_hit  += from->c_hit;
+	to->c_miss += from->c_miss;
+	to->dc_hit += from->dc_hit;
+	to->match  += from->match;
+	to->exec   += from->exec;
+	to->cpu    += from->cpu;
+	to->workers += from->workers;
+
+	if (to->hist && from->hist) {
+		for (i = 0; i < RNM_LAT_MAX; i++) {
+			for (k = 0; k < HIST_BUCKETS; k++) {
+				to->hist->count[i][k] += from->hist->count[i][k];
+			}
+			if (to->hist->max[i] < from->hist->max[i]) {
+				to->hist->max[i] = from->hist->max[i];
+			}
+		}
+	}
+}
+
+/* 'wall' is the time of the whole walk, 'cpu' is the CPU time of the walk
+   thread in the meantime */
+void rename_stats_report(RENOP *opt, FILE *fp, double wall, double cpu)
+{
+	RNMSTATS	*st = &opt->stats;
+	struct	rusage	ru;
+	double	walk, exec, total, share;
+
+	/* the jobs done by the walk thread itself are in 'exec' as well,
+	 * but the workers' time is not in 'wall' */
+	exec = st->workers ? 0 : st->exec;
+	walk = wall - st->match - exec;
+	if (walk < 0) {
+		walk = 0;
+	}
+	share = (wall > 0) ? cpu / wall : 0;
+	total = cpu + st->cpu;
+	if (!getrusage(RUSAGE_SELF, &ru)) {
+		total = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+			ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+	}
+
+	fprintf(fp, "Directories read:   %lu\n", st->dirs);
+	if (st->dc_hit) {
+		fprintf(fp, "Directories cached: %lu\n", st->dc_hit);
+	}
+	fprintf(fp, "Entries seen:       %lu\n", st->entries);
+	fprintf(fp, "Stat calls:         %lu\n", st->stats);
+	fprintf(fp, "Renamed:            %lu\n", st->state[RNM_REP_OK]);
+	fprintf(fp, "Ownership changed:  %lu\n", st->state[RNM_REP_CHOWN]);
+	fprintf(fp, "Permission changed: %lu\n", st->state[RNM_REP_CHMOD]);
+	fprintf(fp, "Tested:             %lu\n", st->state[RNM_REP_TEST]);
+	fprintf(fp, "Skipped:            %lu\n", st->state[RNM_REP_SKIP]);
+	fprintf(fp, "Failed:             %lu\n", st->state[RNM_REP_FAILED]);
+	fprintf(fp, "Name cache:         %lu hits, %lu misses\n",
+			st->c_hit, st->c_miss);
+	fprintf(fp, "Traversal:          %.3fs wall, %.3fs cpu\n",
+			walk, walk * share);
+	fprintf(fp, "Matching:           %.3fs wall, %.3fs cpu\n",
+			st->match, st->match * share);
+	if (st->workers) {
+		fprintf(fp, "Execution:          %.3fs busy in %d workers, "
+				"%.3fs cpu\n", st->exec, st->workers, st->cpu);
+	} else {
+		fprintf(fp, "Execution:          %.3fs wall, %.3fs cpu\n",
+				exec, exec * share);
+	}
+	fprintf(fp, "Total:              %.3fs wall, %.3fs cpu, "
+			"%.0f entries/s\n", wall, total,
+			(wall > 0) ? st->entries / wall : 0);
+}
+
+/* start recording the latency histograms of the thread */
+int rename_stats_hist(RNMSTATS *st)
+{
+	if (st->hist == NULL) {
+		st->hist = calloc(1, sizeof(struct _RNMHIST));
+	}
+	return st->hist ? RNM_ERR_NONE : RNM_ERR_LOWMEM;
+}
+
+void rename_stats_free(RNMSTATS *st)
+{
+	free(st->hist);
+	st->hist = NULL;
+}
+
+/* the time before a system call in nanoseconds, or 0 if the latency is
+   not recorded in this thread */
+unsigned long long rename_lat_start(RNMSTATS *st)
+{
+	struct	timespec	ts;
+
+	if (st->hist == NULL) {
+		return 0;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* record the latency of the system call of the 'type'. It keeps errno */
+void rename_lat_stop(RNMSTATS *st, int type, unsigned long long start)
+{
+	struct	timespec	ts;
+	unsigned long long	ns;
+
+	if (st->hist == NULL) {
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec - start;
+	st->hist->count[type][hist_index(ns)]++;
+	if (st->hist->max[type] < ns) {
+		st->hist->max[type] = ns;
+	}
+}
+
+static int hist_index(unsigned long long ns)
+{
+	int	shift;
+
+	if (ns >= (1ULL << HIST_MAXBITS)) {
+		ns = (1ULL << HIST_MAXBITS) - 1;
+	}
+	if (ns < HIST_SUB * 2) {
+		return (int) ns;
+	}
+	shift = 63 - __builtin_clzll(ns) - HIST_SUBBITS;
+	return shift * HIST_SUB + (int)(ns >> shift);
+}
+
+/* the lowest latency of the bucket */
+static unsigned long long hist_value(int idx)
+{
+	int	shift;
+
+	if (idx < HIST_SUB * 2) {
+		return idx;
+	}
+	shift = idx / HIST_SUB - 1;
+	return (unsigned long long)(idx - shift * HIST_SUB) << shift;
+}
+
+static void lat_print(FILE *fp, unsigned long long ns)
+{
+	if (ns < 10000) {
+		fprintf(fp, "%6lluns", ns);
+	} else if (ns < 10000000) {
+		fprintf(fp, "%6.1fus", ns / 1e3);
+	} else {
+		fprintf(fp, "%6.1fms", ns / 1e6);
+	}
+}
+
+/* print p50, p99, p999 and the maximum of every type of the system calls.
+   A percentile is told by the middle of its bucket */
+void rename_stats_latency(RENOP *opt, FILE *fp)
+{
+	static	double	pct[] = { 0.5, 0.99, 0.999 };
+	static	char	*label[] = { "p50", "p99", "p999" };
+	struct	_RNMHIST	*hist = opt->stats.hist;
+	unsigned long	total, sum, *cnt;
+	int	i, k, n;
+
+	if (hist == NULL) {
+		return;
+	}
+	for (i = 0; i < RNM_LAT_MAX; i++) {
+		cnt = hist->count[i];
+		for (k = total = 0; k < HIST_BUCKETS; k++) {
+			total += cnt[k];
+		}
+		if (total == 0) {
+			continue;
+		}
+		fprintf(fp, "Latency of %-8s %9lu calls", lat_name[i], total);
+		for (n = k = sum = 0; n < 3; n++) {
+			for ( ; (k < HIST_BUCKETS) && 
+					(sum + cnt[k] < pct[n] * total); k++) {
+				sum += cnt[k];
+			}
+			fprintf(fp, "  %s ", label[n]);
+			lat_print(fp, (hist_value(k) + hist_value(k + 1)) / 2);
+		}
+		fprintf(fp, "  max ");
+		lat_print(fp, hist->max[i]);
+		fputc('\n', fp);
+	}
+}
+
+/* write the non-empty buckets as the lines of the type, the lowest and the
+   highest nanoseconds of the bucket, and the count, separated by tabs */
+int rename_stats_dump(RENOP *opt, const char *path)
+{
+	struct	_RNMHIST	*hist = opt->stats.hist;
+	FILE	*fp;
+	int	i, k;
+
+	if (hist == NULL) {
+		return RNM_ERR_NONE;
+	}
+	if ((fp = fopen(path, "w")) == NULL) {
+		return RNM_ERR_OPENFILE;
+	}
+	for (i = 0; i < RNM_LAT_MAX; i++) {
+		for (k = 0; k < HIST_BUCKETS; k++) {
+			if (hist->count[i][k]) {
+				fprintf(fp, "%s\t%llu\t%llu\t%lu\n", lat_name[i],
+						hist_value(k), 
+						hist_value(k + 1) - 1,
+						hist->count[i][k]);
+			}
+		}
+	}
+	fclose(fp);
+	return RNM_ERR_NONE;
+}
@@ -0,0 +1,708 @@
+/*  watch.c - rename the new files of the watched directories by inotify
+
+    Copyright (C) 1998-2011  "Andy Xuming" <xuming@users.sourceforge.net>
+
+    This file is part of RENAME, a utility to help file renaming
+
+    RENAME is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    RENAME is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/inotify.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#if STDC_HEADERS
+  #include <string.h>
+#endif
+
+#if HAVE_UNISTD_H
+  #include <sys/types.h>
+  #include <unistd.h>
+#endif
+
+#if HAVE_REGEX_H
+  #include <regex.h>
+#else
+  #include "regex.h"
+#endif
+
+#include "rename.h"
+
+/* Every directory watched is held by a descriptor rather than its path, so
+   it can be renamed, by us or anyone, while it's watched. The events are
+   collected until the directories are quiet for the 'delay', or for ten
+   times of it at most, then the names of the batch are renamed once each,
+   as if they were the command line names. A name gone by then is skipped;
+   it was a temporary file or it was moved on already.
+
+   The renames done by renamex itself come back as IN_MOVED_TO events too.
+   The new names are remembered by the report callback so they are not
+   renamed again, which would never end with a rule like s/a/aa/. They're
+   kept for a few batches, which is also how far back a rescan looks.
+
+   When the kernel queue overflows, the watched directories are read again.
+   An entry changed since the oldest names remembered were done, which is
+   not one of them, is renamed as a new one; anything older had its events
+   before. A directory to watch is only renamed if it was not watched yet,
+   since its times change with its entries, and then it's walked as a new
+   one; past --max-depth, pruned or on another device under -x, it's taken
+   as a file. */
+#define WATCH_MASK	(IN_CREATE | IN_MOVED_TO | IN_EXCL_UNLINK | IN_ONLYDIR)
+#define WATCH_BATCH	4096		/* events of a batch, roughly */
+#define WATCH_BUFSIZE	65536		/* of a read() */
+#define WATCH_HASH	4096		/* buckets of the names done at first */
+#define WATCH_AGES	4		/* batches a name done is kept */
+
+typedef	struct	{
+	int	fd;		/* -1 if not watched */
+	int	depth;		/* 0 for the command line directories */
+	dev_t	dev;
+	ino_t	ino;
+	int	scan;		/* the last rescan it was read by */
+} WATCHDIR;
+
+typedef	struct	_WATCHNAME	{
+	struct	_WATCHNAME	*next;
+	dev_t	dev;		/* the directory of the name */
+	ino_t	ino;
+	int	age;		/* the batch when it was done */
+	int	seen;		/* its event came */
+	char	name[1];
+} WATCHNAME;
+
+typedef	struct	{
+	int	wd;
+	unsigned	mask;
+	char	*name;
+} WATCHEVENT;
+
+static	struct	{
+	int		ifd;
+	int		delay;		/* milliseconds */
+	WATCHDIR	*dirs;		/* indexed by the watch descriptor */
+	int		dir_num;
+	int		*roots;		/* the watch descriptors of the roots */
+	int		root_num;
+	char		*path;		/* of the current directory */
+
+	pthread_mutex_t	lock;		/* of the names done */
+	WATCHNAME	**ours;
+	unsigned	our_size;	/* buckets, a power of 2 */
+	int		our_num;
+	int		age;
+	int		dropped;	/* the batch a name done was lost */
+	int		scans;
+	struct	timespec	since[WATCH_AGES + 1];	/* the batches began */
+} watch = { -1, 0, NULL, 0, NULL, 0, NULL, PTHREAD_MUTEX_INITIALIZER };
+
+static int watch_add(RENOP *opt, int fd, int depth, dev_t root);
+static int watch_one(int fd, int depth, int *fresh);
+static void watch_subdirs(RENOP *opt, int wd, dev_t root);
+static int watch_dive(RENOP *opt, char *name, int depth);
+static int watch_collect(WATCHEVENT *ev, int *overflow);
+static int watch_event(RENOP *opt, WATCHEVENT *ev);
+static int watch_rename(RENOP *opt, int wd, char *name);
+static int watch_rescan(RENOP *opt);
+static int watch_rescan_dir(RENOP *opt, int wd, struct timespec *since);
+static int watch_cmp(const void *a, const void *b);
+static char *watch_path(int fd);
+static void watch_report(void *data, int dfd, const char *dest,
+		const char *sour, int state, int err);
+static void watch_grow(void);
+static unsigned watch_hash(dev_t dev, ino_t ino, const char *name);
+static int watch_ours(dev_t dev, ino_t ino, const char *name, int peek);
+static void watch_expire(void);
+static long watch_msec(void);
+
+
+/* watch the directories of the command line, before the first pass so no
+   file coming in between is missed. The subdirectories are watched down to
+   --max-depth as well; it needs -R, see main.c */
+int rename_watch_open(RENOP *opt, char **argv, int argc, int delay)
+{
+	struct	rlimit	rl;
+	struct	stat	fs;
+	int	i, fd;
+
+	if ((watch.ifd = inotify_init1(IN_CLOEXEC)) < 0) {
+		perror("inotify");
+		return RNM_ERR_OPENFILE;
+	}
+	/* a descriptor per directory watched */
+	if (!getrlimit(RLIMIT_NOFILE, &rl) && (rl.rlim_cur < rl.rlim_max)) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+	watch.our_size = WATCH_HASH;
+	watch.ours  = calloc(watch.our_size, sizeof(WATCHNAME *));
+	watch.roots = calloc(argc, sizeof(int));
+	if (!watch.ours || !watch.roots) {
+		return RNM_ERR_LOWMEM;
+	}
+	watch.dropped = -WATCH_AGES - 1;
+	clock_gettime(CLOCK_REALTIME, &watch.since[0]);
+	watch.delay = (delay > 0) ? delay : 1;
+	for (i = 0; i < argc; i++) {
+		fd = open(argv[i], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if ((fd < 0) || fstat(fd, &fs)) {
+			perror(argv[i]);
+			return RNM_ERR_OPENDIR;
+		}
+		if ((watch.roots[watch.root_num++] = watch_add(opt, fd, 0,
+						fs.st_dev)) < 0) {
+			perror(argv[i]);
+			return RNM_ERR_OPENDIR;
+		}
+	}
+	opt->cb.report = watch_report;
+	return RNM_ERR_NONE;
+}
+
+/* rename the new files batch by batch, until killed */
+int rename_watch(RENOP *opt)
+{
+	WATCHEVENT	*ev;
+	int	i, n, rc, overflow;
+
+	/* a read() could overrun the batch by a buffer of events */
+	n = WATCH_BATCH + WATCH_BUFSIZE / sizeof(struct inotify_event);
+	if ((ev = malloc(n * sizeof(WATCHEVENT))) == NULL) {
+		return RNM_ERR_LOWMEM;
+	}
+	rename_output_flush(opt);
+	while (1) {
+		overflow = 0;
+		if ((n = watch_collect(ev, &overflow)) < 0) {
+			perror("inotify");
+			break;
+		}
+		/* a name is done once however many events it had */
+		qsort(ev, n, sizeof(WATCHEVENT), watch_cmp);
+		for (i = 0; i < n; i++) {
+			if (i && !watch_cmp(&ev[i - 1], &ev[i])) {
+				ev[i].mask |= ev[i - 1].mask;
+				continue;
+			}
+			if ((i + 1 < n) && !watch_cmp(&ev[i], &ev[i + 1])) {
+				continue;	/* the last one is done */
+			}
+			watch_event(opt, &ev[i]);
+		}
+		for (i = 0; i < n; i++) {
+			free(ev[i].name);
+		}
+		if (overflow) {
+			watch_rescan(opt);
+		}
+		if ((rc = rename_finish(opt)) != RNM_ERR_NONE) {
+			break;
+		}
+		rename_output_flush(opt);
+		watch_expire();
+	}
+	free(ev);
+	return RNM_ERR_OPENFILE;
+}
+
+/* watch the directory 'fd', which is taken over, and its subdirectories
+   with -R. It returns the watch descriptor, or -1 */
+static int watch_add(RENOP *opt, int fd, int depth, dev_t root)
+{
+	int	wd, fresh;
+
+	if ((wd = watch_one(fd, depth, &fresh)) >= 0) {
+		watch_subdirs(opt, wd, root);
+	}
+	return wd;
+}
+
+/* watch the subdirectories of the watched directory 'wd' with -R */
+static void watch_subdirs(RENOP *opt, int wd, dev_t root)
+{
+	struct	stat	fs;
+	struct	dirent	*de;
+	DIR	*dir;
+	int	sfd, n, depth = watch.dirs[wd].depth;
+
+	if (!(opt->cflags & RNM_CFLAG_RECUR) ||
+			((sfd = dup(watch.dirs[wd].fd)) < 0)) {
+		return;
+	}
+	if ((dir = fdopendir(sfd)) == NULL) {
+		close(sfd);
+		return;
+	}
+	rewinddir(dir);		/* the offset is shared with the dup() */
+	while ((de = readdir(dir)) != NULL) {
+		if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) {
+			continue;
+		}
+#ifdef	_DIRENT_HAVE_D_TYPE
+		if ((de->d_type != DT_DIR) && (de->d_type != DT_UNKNOWN)) {
+			continue;
+		}
+#endif
+		if (!watch_dive(opt, de->d_name, depth + 1)) {
+			continue;
+		}
+		if (fstatat(sfd, de->d_name, &fs, AT_SYMLINK_NOFOLLOW) ||
+				!S_ISDIR(fs.st_mode)) {
+			continue;
+		}
+		if ((opt->cflags & RNM_CFLAG_XDEV) && (fs.st_dev != root)) {
+			continue;
+		}
+		n = openat(sfd, de->d_name,
+				O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+		if ((n >= 0) && (watch_add(opt, n, depth + 1, root) < 0) &&
+				opt->cb.error) {
+			opt->cb.error(opt->cb.data, de->d_name, errno);
+		}
+	}
+	closedir(dir);
+}
+
+/* watch the directory 'fd' alone, which is taken over. The 'fresh' is set
+   if it was not watched yet. It returns the watch descriptor, or -1 */
+static int watch_one(int fd, int depth, int *fresh)
+{
+	WATCHDIR	*dirs;
+	struct	stat	fs;
+	char	proc[64];
+	int	wd, n;
+
+	/* inotify takes a path only, so the directory is named by its
+	 * descriptor to be sure it's the one opened */
+	sprintf(proc, "/proc/self/fd/%d", fd);
+	if (fstat(fd, &fs) ||
+			((wd = inotify_add_watch(watch.ifd, proc, WATCH_MASK)) < 0)) {
+		n = errno;
+		close(fd);
+		errno = n;
+		return -1;
+	}
+	*fresh = 0;
+	if ((wd < watch.dir_num) && (watch.dirs[wd].fd >= 0)) {
+		close(fd);		/* watched already, maybe moved */
+		watch.dirs[wd].depth = depth;
+		return wd;
+	}
+	if (wd >= watch.dir_num) {
+		n = wd + 256;
+		if ((dirs = realloc(watch.dirs, n * sizeof(WATCHDIR))) == NULL) {
+			inotify_rm_watch(watch.ifd, wd);
+			close(fd);
+			errno = ENOMEM;
+			return -1;
+		}
+		for ( ; watch.dir_num < n; watch.dir_num++) {
+			dirs[watch.dir_num].fd = -1;
+		}
+		watch.dirs = dirs;
+	}
+	watch.dirs[wd].fd    = fd;
+	watch.dirs[wd].depth = depth;
+	watch.dirs[wd].dev   = fs.st_dev;
+	watch.dirs[wd].ino   = fs.st_ino;
+	watch.dirs[wd].scan  = watch.scans;
+	*fresh = 1;
+	return wd;
+}
+
+/* would the walk descend the directory 'name' at the 'depth' */
+static int watch_dive(RENOP *opt, char *name, int depth)
+{
+	if ((opt->rule->maxdepth >= 0) && (depth >= opt->rule->maxdepth)) {
+		return 0;
+	}
+	if (opt->rule->filter &&
+			(rename_filter_match(opt->rule, RNM_FILTER_EXCLUDE, name) ||
+			rename_filter_match(opt->rule, RNM_FILTER_PRUNE, name))) {
+		return 0;
+	}
+	return 1;
+}
+
+/* wait for the first event, then take the events until the directories
+   are quiet for the delay. It returns the number of the events */
+static int watch_collect(WATCHEVENT *ev, int *overflow)
+{
+	struct	pollfd	pfd;
+	struct	inotify_event	*ie;
+	char	buf[WATCH_BUFSIZE] __attribute__ ((aligned(__alignof__(struct
+						inotify_event))));
+	char	*p;
+	long	deadline = 0;
+	int	n = 0, len, rc, wait = -1;
+
+	pfd.fd = watch.ifd;
+	pfd.events = POLLIN;
+	while (n < WATCH_BATCH) {
+		if ((rc = poll(&pfd, 1, wait)) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		if (rc == 0) {
+			break;		/* quiet for the delay */
+		}
+		if ((len = read(watch.ifd, buf, sizeof(buf))) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		for (p = buf; p < buf + len; p += sizeof(*ie) + ie->len) {
+			ie = (struct inotify_event *) p;
+			if (ie->mask & IN_Q_OVERFLOW) {
+				*overflow = 1;
+			} else if (ie->mask & IN_IGNORED) {
+				/* the directory was removed */
+				if ((ie->wd < watch.dir_num) &&
+						(watch.dirs[ie->wd].fd >= 0)) {
+					close(watch.dirs[ie->wd].fd);
+					watch.dirs[ie->wd].fd = -1;
+				}
+			} else if (ie->len &&
+					((ev[n].name = strdup(ie->name)) != NULL)) {
+				ev[n].wd   = ie->wd;
+				ev[n].mask = ie->mask;
+				n++;
+			}
+		}
+		if (deadline == 0) {
+			deadline = watch_msec() + watch.delay * 10;
+		}
+		wait = (int)(deadline - watch_msec());
+		if (wait <= 0) {
+			break;
+		}
+		if (wait > watch.delay) {
+			wait = watch.delay;
+		}
+	}
+	return n;
+}
+
+static int watch_event(RENOP *opt, WATCHEVENT *ev)
+{
+	WATCHDIR	*wdir;
+	struct	stat	fs;
+	int	fd;
+
+	if ((ev->wd >= watch.dir_num) || (watch.dirs[ev->wd].fd < 0)) {
+		return RNM_ERR_NONE;
+	}
+	wdir = &watch.dirs[ev->wd];
+	if ((ev->mask & IN_MOVED_TO) &&
+			watch_ours(wdir->dev, wdir->ino, ev->name, 0)) {
+		return RNM_ERR_NONE;
+	}
+	if (fstatat(wdir->fd, ev->name, &fs, AT_SYMLINK_NOFOLLOW)) {
+		return RNM_ERR_NONE;	/* gone already */
+	}
+
+	/* a new directory is watched before it's walked, so nothing coming
+	 * into it is missed */
+	if (S_ISDIR(fs.st_mode) && (opt->cflags & RNM_CFLAG_RECUR) &&
+			watch_dive(opt, ev->name, wdir->depth + 1) &&
+			(!(opt->cflags & RNM_CFLAG_XDEV) ||
+			(fs.st_dev == wdir->dev))) {
+		fd = openat(wdir->fd, ev->name,
+				O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+		if ((fd >= 0) && (watch_add(opt, fd, wdir->depth + 1,
+						wdir->dev) < 0) && opt->cb.error) {
+			opt->cb.error(opt->cb.data, ev->name, errno);
+		}
+	}
+	return watch_rename(opt, ev->wd, ev->name);
+}
+
+/* rename the entry of the watched directory as a command line name */
+static int watch_rename(RENOP *opt, int wd, char *name)
+{
+	WATCHDIR	*wdir = &watch.dirs[wd];
+	char	*path = NULL;
+	int	rc;
+
+	if ((opt->dir == NULL) || (opt->topdir.fd != wdir->fd)) {
+		if (opt->outfmt != RNM_OUT_TEXT) {
+			path = watch_path(wdir->fd);
+		}
+		if ((rc = rename_topdir(opt, wdir->fd, path)) != RNM_ERR_NONE) {
+			free(path);
+			return rc;
+		}
+		free(watch.path);
+		watch.path = path;
+	}
+	opt->depth = wdir->depth + 1;
+	opt->xdev  = wdir->dev;
+	rc = rename_entry(opt, wdir->fd, name);
+	opt->depth = 0;
+	return rc;
+}
+
+/* some events were lost, so the watched directories are read again for
+   the entries changed since the oldest names done were done. The ones
+   watched by the rescan itself were walked whole already */
+static int watch_rescan(RENOP *opt)
+{
+	struct	timespec	since;
+	int	wd;
+
+	since = watch.since[(watch.age < WATCH_AGES) ? 0 :
+		(watch.age - WATCH_AGES) % (WATCH_AGES + 1)];
+	watch.scans++;
+	for (wd = 0; wd < watch.dir_num; wd++) {
+		if ((watch.dirs[wd].fd >= 0) &&
+				(watch.dirs[wd].scan != watch.scans)) {
+			watch.dirs[wd].scan = watch.scans;
+			watch_rescan_dir(opt, wd, &since);
+		}
+	}
+	return rename_finish(opt);
+}
+
+/* the names are read before any is renamed, or readdir() could meet a
+   renamed one again */
+static int watch_rescan_dir(RENOP *opt, int wd, struct timespec *since)
+{
+	WATCHDIR	*wdir = &watch.dirs[wd];
+	struct	stat	fs;
+	struct	dirent	*de;
+	DIR	*dir;
+	char	**names = NULL, **p;
+	int	i, n = 0, fd, sub, fresh, dfd = wdir->fd, depth = wdir->depth;
+	dev_t	dev = wdir->dev;
+	ino_t	ino = wdir->ino;
+
+	if (((fd = dup(dfd)) < 0) || ((dir = fdopendir(fd)) == NULL)) {
+		if (fd >= 0) {
+			close(fd);
+		}
+		return RNM_ERR_OPENDIR;
+	}
+	rewinddir(dir);
+	while ((de = readdir(dir)) != NULL) {
+		if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) {
+			continue;
+		}
+		if ((p = realloc(names, (n + 1) * sizeof(char *))) == NULL) {
+			break;
+		}
+		names = p;
+		if ((names[n] = strdup(de->d_name)) != NULL) {
+			n++;
+		}
+	}
+	closedir(dir);
+
+	for (i = 0; i < n; i++) {
+		if (fstatat(dfd, names[i], &fs, AT_SYMLINK_NOFOLLOW)) {
+			continue;	/* gone already */
+		}
+		/* a directory to watch could not be told by its times, which
+		 * change with its entries, so it's new if it was not watched.
+		 * The ones not descended are renamed as the files are */
+		if (S_ISDIR(fs.st_mode) &&
+				watch_dive(opt, names[i], depth + 1) &&
+				(!(opt->cflags & RNM_CFLAG_XDEV) ||
+				(fs.st_dev == dev))) {
+			fd = openat(dfd, names[i],
+				O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+			if ((fd < 0) ||
+					((sub = watch_one(fd, depth + 1, &fresh)) < 0) ||
+					!fresh) {
+				continue;
+			}
+			watch_subdirs(opt, sub, dev);
+		} else if ((fs.st_ctim.tv_sec < since->tv_sec) ||
+				((fs.st_ctim.tv_sec == since->tv_sec) &&
+				(fs.st_ctim.tv_nsec < since->tv_nsec)) ||
+				watch_ours(dev, ino, names[i], 1)) {
+			continue;
+		}
+		watch_rename(opt, wd, names[i]);
+	}
+	for (i = 0; i < n; i++) {
+		free(names[i]);
+	}
+	free(names);
+	return RNM_ERR_NONE;
+}
+
+static int watch_cmp(const void *a, const void *b)
+{
+	const	WATCHEVENT	*x = a, *y = b;
+
+	if (x->wd != y->wd) {
+		return x->wd - y->wd;
+	}
+	return strcmp(x->name, y->name);
+}
+
+/* where the directory is now */
+static char *watch_path(int fd)
+{
+	char	proc[64], buf[PATH_MAX];
+	int	len;
+
+	sprintf(proc, "/proc/self/fd/%d", fd);
+	if ((len = readlink(proc, buf, sizeof(buf) - 1)) < 0) {
+		return NULL;
+	}
+	buf[len] = 0;
+	return strdup(buf);
+}
+
+/* remember the new names; it could be called by the workers */
+static void watch_report(void *data, int dfd, const char *dest,
+		const char *sour, int state, int err)
+{
+	WATCHNAME	*wn;
+	struct	stat	fs;
+	unsigned	h;
+
+	if ((state != RNM_REP_OK) || !strcmp(dest, sour) || fstat(dfd, &fs)) {
+		return;
+	}
+	if ((wn = malloc(sizeof(WATCHNAME) + strlen(dest))) != NULL) {
+		wn->dev = fs.st_dev;
+		wn->ino = fs.st_ino;
+		strcpy(wn->name, dest);
+	}
+
+	pthread_mutex_lock(&watch.lock);
+	if (wn == NULL) {
+		/* its event would be taken for a new file, so every event is
+		 * until the name would have been forgotten anyway */
+		watch.dropped = watch.age;
+		pthread_mutex_unlock(&watch.lock);
+		return;
+	}
+	if ((unsigned) watch.our_num >= watch.our_size * 2) {
+		watch_grow();
+	}
+	wn->age  = watch.age;
+	wn->seen = 0;
+	h = watch_hash(wn->dev, wn->ino, wn->name) & (watch.our_size - 1);
+	wn->next = watch.ours[h];
+	watch.ours[h] = wn;
+	watch.our_num++;
+	pthread_mutex_unlock(&watch.lock);
+}
+
+/* double the buckets of the names done; it's locked. The chains just get
+   longer if there is no memory for it */
+static void watch_grow(void)
+{
+	WATCHNAME	**ours, *wn;
+	unsigned	i, h, size = watch.our_size * 2;
+
+	if ((ours = calloc(size, sizeof(WATCHNAME *))) == NULL) {
+		return;
+	}
+	for (i = 0; i < watch.our_size; i++) {
+		while ((wn = watch.ours[i]) != NULL) {
+			watch.ours[i] = wn->next;
+			h = watch_hash(wn->dev, wn->ino, wn->name) & (size - 1);
+			wn->next = ours[h];
+			ours[h]  = wn;
+		}
+	}
+	free(watch.ours);
+	watch.ours = ours;
+	watch.our_size = size;
+}
+
+static unsigned watch_hash(dev_t dev, ino_t ino, const char *name)
+{
+	unsigned	h = (unsigned)(dev * 31 + ino);
+
+	while (*name) {
+		h = h * 33 + (unsigned char) *name++;
+	}
+	return h;
+}
+
+/* was the name made by renamex. An event takes it once, since the name
+   could be made by anyone else later; the 'peek' of a rescan does not */
+static int watch_ours(dev_t dev, ino_t ino, const char *name, int peek)
+{
+	WATCHNAME	*wn;
+	int	found = 0;
+
+	pthread_mutex_lock(&watch.lock);
+	wn = watch.ours[watch_hash(dev, ino, name) & (watch.our_size - 1)];
+	for ( ; wn != NULL; wn = wn->next) {
+		if ((wn->dev == dev) && (wn->ino == ino) &&
+				!strcmp(wn->name, name) && (peek || !wn->seen)) {
+			wn->seen = !peek;
+			found = 1;
+			break;
+		}
+	}
+	if (watch.age - watch.dropped <= WATCH_AGES) {
+		found = 1;
+	}
+	pthread_mutex_unlock(&watch.lock);
+	return found;
+}
+
+/* the events of the renames come in the next batch or so; the names not
+   seen by then are not going to be */
+static void watch_expire(void)
+{
+	WATCHNAME	**pp, *wn;
+	int	i;
+
+	pthread_mutex_lock(&watch.lock);
+	watch.age++;
+	clock_gettime(CLOCK_REALTIME, &watch.since[watch.age % (WATCH_AGES + 1)]);
+	for (i = 0; watch.our_num && (i < (int) watch.our_size); i++) {
+		for (pp = &watch.ours[i]; (wn = *pp) != NULL; ) {
+			if (watch.age - wn->age > WATCH_AGES) {
+				*pp = wn->next;
+				watch.our_num--;
+				free(wn);
+			} else {
+				pp = &wn->next;
+			}
+		}
+	}
+	pthread_mutex_unlock(&watch.lock);
+}
+
+static long watch_msec(void)
+{
+	struct	timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}